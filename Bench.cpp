@@ -0,0 +1,467 @@
+// Headless benchmark for the simulation engines, built on its own with `make bench`.
+// Fills a grid at random or loads a pattern, runs a number of updates of one engine
+// and prints throughput, per update latency and peak memory as CSV or JSON,
+// so runs on different machines or commits can be compared line by line.
+
+#include "BitCells.h"
+#include "Cells.h"
+#include "HashLife.h"
+#include "LutCells.h"
+#include "SparseCells.h"
+#include "TiledCells.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+  struct Options
+  {
+    std::string engine{ "cells" };
+    std::string kernel; // Cells only, the best one the CPU has if empty
+    std::size_t width{ 1024 };
+    std::size_t height{ 1024 };
+    double density{ 0.4 };
+    std::uint64_t updates{ 100 };
+    std::uint64_t batch{ 1 }; // generations each update asks for at once
+    std::uint64_t warmup{ 0 };
+    std::uint64_t seed{ 1 };
+    std::size_t threads{ 1 };
+    int stepExponent{ 0 }; // HashLife only
+    std::string rule;
+    bool torus{ false };
+    std::string load; // RLE or plaintext pattern placed in the middle of the grid
+    std::string file; // Cells only, grid kept in this file instead of memory
+    std::string format{ "csv" };
+    bool header{ true };
+  };
+
+  void usage()
+  {
+    std::fprintf(stderr,
+      "usage: life-bench [options]\n"
+      "  --engine cells|bits|hashlife|sparse|events|tiled|lut  engine to run (cells)\n"
+      "  --kernel scalar|sse2|avx2|avx512                      cells or tiled kernel (best available)\n"
+      "  --size WxH                                            grid size (1024x1024)\n"
+      "  --density D                                           chance 0-1 of a cell being alive (0.4)\n"
+      "  --load FILE                                           pattern (.rle or .cells) instead of random cells\n"
+      "  --file PATH                                           keep the cells or events grid in PATH, carry on if it's one\n"
+      "  --gens N                                              updates to time (100)\n"
+      "  --batch K                                             run each update as step(K), in blocks on cells (1)\n"
+      "  --warmup N                                            updates to run before timing (0)\n"
+      "  --seed N                                              random seed (1)\n"
+      "  --threads N                                           threads, 0 for one per core (1)\n"
+      "  --step E                                              HashLife advances 2^E generations per update (0)\n"
+      "  --rule B3/S23                                         rule, or the pattern's own (B3/S23)\n"
+      "  --torus                                               wrap the edges around\n"
+      "  --format csv|json                                     output format (csv)\n"
+      "  --no-header                                           leave out the CSV header, for appending\n");
+  }
+
+  bool toNumber(const char* text, std::uint64_t& value)
+  {
+    char* end{ nullptr };
+    value = std::strtoull(text, &end, 10);
+    return *text && *end == '\0';
+  }
+
+  bool parseOptions(int argc, char** argv, Options& o)
+  {
+    for (int a = 1; a < argc; a++)
+    {
+      const std::string arg{ argv[a] };
+      const char* const value = a + 1 < argc ? argv[a + 1] : nullptr;
+      std::uint64_t n{ 0 };
+
+      if (arg == "--torus") o.torus = true;
+      else if (arg == "--no-header") o.header = false;
+      else if (arg == "--help" || arg == "-h") return false;
+      else if (!value)
+      {
+        std::fprintf(stderr, "%s needs a value\n", arg.c_str());
+        return false;
+      }
+      else
+      {
+        a++;
+        if (arg == "--engine") o.engine = value;
+        else if (arg == "--kernel") o.kernel = value;
+        else if (arg == "--load") o.load = value;
+        else if (arg == "--file") o.file = value;
+        else if (arg == "--rule") o.rule = value;
+        else if (arg == "--format") o.format = value;
+        else if (arg == "--size")
+        {
+          unsigned long long w{ 0 }, h{ 0 };
+          if (std::sscanf(value, "%llux%llu", &w, &h) != 2 || !w || !h) return false;
+          o.width = static_cast<std::size_t>(w);
+          o.height = static_cast<std::size_t>(h);
+        }
+        else if (arg == "--density")
+        {
+          char* end{ nullptr };
+          o.density = std::strtod(value, &end);
+          if (*end || o.density < 0 || o.density > 1) return false;
+        }
+        else if (!toNumber(value, n)) return false;
+        else if (arg == "--gens") o.updates = n;
+        else if (arg == "--warmup") o.warmup = n;
+        else if (arg == "--batch" && n > 0) o.batch = n;
+        else if (arg == "--seed") o.seed = n;
+        else if (arg == "--threads") o.threads = static_cast<std::size_t>(n);
+        else if (arg == "--step" && n <= 48) o.stepExponent = static_cast<int>(n);
+        else
+        {
+          std::fprintf(stderr, "unknown option %s\n", arg.c_str());
+          return false;
+        }
+      }
+    }
+
+    return o.format == "csv" || o.format == "json";
+  }
+
+  template <typename Engine>
+  bool useKernel(Engine& engine, const std::string& kernel)
+  {
+    if (kernel == "scalar") engine.setKernel(CellKernels::Type::scalar);
+    else if (kernel == "sse2") engine.setKernel(CellKernels::Type::sse2);
+    else if (kernel == "avx2") engine.setKernel(CellKernels::Type::avx2);
+    else if (kernel == "avx512") engine.setKernel(CellKernels::Type::avx512);
+    else if (!kernel.empty()) return false;
+    return true;
+  }
+
+  std::unique_ptr<LifeEngine> makeEngine(const Options& o)
+  {
+    if (o.engine == "bits") return std::make_unique<BitCells>();
+    if (o.engine == "sparse") return std::make_unique<SparseCells>();
+    if (o.engine == "lut") return std::make_unique<LutCells>();
+    if (o.engine == "hashlife")
+    {
+      auto hashLife = std::make_unique<HashLife>();
+      hashLife->setStepExponent(o.stepExponent);
+      return hashLife;
+    }
+    if (o.engine == "tiled")
+    {
+      auto tiled = std::make_unique<TiledCells>();
+      if (!useKernel(*tiled, o.kernel)) return nullptr;
+      return tiled;
+    }
+    if (o.engine != "cells" && o.engine != "events") return nullptr;
+
+    auto cells = std::make_unique<Cells>();
+    cells->setEventDriven(o.engine == "events");
+    if (!useKernel(*cells, o.kernel)) return nullptr;
+    return cells;
+  }
+
+  const char* kernelName(const LifeEngine& engine, const Options& o)
+  {
+    CellKernels::Type type;
+    if (o.engine == "cells") type = static_cast<const Cells&>(engine).getKernel();
+    else if (o.engine == "tiled") type = static_cast<const TiledCells&>(engine).getKernel();
+    else return ""; // events doesn't use the kernels
+
+    switch (type)
+    {
+    case CellKernels::Type::avx512: return "avx512";
+    case CellKernels::Type::avx2: return "avx2";
+    case CellKernels::Type::sse2: return "sse2";
+    default: return "scalar";
+    }
+  }
+
+  // Reads an RLE pattern, such as the ones on LifeWiki, into bitmap.
+  // The rule from its header line is put in rule if it's one Rule can read.
+  bool loadRle(std::istream& in, Bitmap& bitmap, std::string& rule)
+  {
+    std::string line;
+    std::size_t w{ 0 }, h{ 0 };
+    bool sized{ false };
+    while (!sized && std::getline(in, line))
+    {
+      if (line.empty() || line[0] == '#') continue;
+
+      unsigned long long x{ 0 }, y{ 0 };
+      if (std::sscanf(line.c_str(), " x = %llu , y = %llu", &x, &y) != 2) return false;
+      w = static_cast<std::size_t>(x);
+      h = static_cast<std::size_t>(y);
+
+      const auto r = line.find("rule");
+      const auto eq = line.find('=', r);
+      if (r != std::string::npos && eq != std::string::npos) rule = line.substr(eq + 1);
+      if (!rule.empty() && rule.back() == '\r') rule.pop_back();
+      sized = true;
+    }
+    if (!sized) return false;
+
+    bitmap = Bitmap(0, 0, w, h);
+    std::int64_t i{ 0 }, j{ 0 };
+    std::uint64_t count{ 0 };
+    char c;
+    while (in.get(c) && c != '!')
+    {
+      if (c >= '0' && c <= '9')
+      {
+        count = count * 10 + static_cast<std::uint64_t>(c - '0');
+        continue;
+      }
+      if (c == ' ' || c == '\t' || c == '\r' || c == '\n') continue;
+
+      const std::uint64_t run = count ? count : 1;
+      count = 0;
+      if (c == 'b' || c == '.') i += static_cast<std::int64_t>(run);
+      else if (c == '$')
+      {
+        i = 0;
+        j += static_cast<std::int64_t>(run);
+      }
+      else if (c >= 'A' && c <= 'z') // o, or any other live state of a multi-state pattern
+        for (std::uint64_t k = 0; k < run; k++) bitmap.set(i++, j);
+    }
+
+    return true;
+  }
+
+  // Plaintext patterns are rows of . and O with ! starting a comment line
+  bool loadPlaintext(std::istream& in, Bitmap& bitmap)
+  {
+    std::vector<std::string> rows;
+    std::size_t w{ 0 };
+    std::string line;
+    while (std::getline(in, line))
+    {
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+      if (!line.empty() && line[0] == '!') continue;
+      w = std::max(w, line.size());
+      rows.push_back(line);
+    }
+
+    bitmap = Bitmap(0, 0, w, rows.size());
+    for (std::size_t j = 0; j < rows.size(); j++)
+      for (std::size_t i = 0; i < rows[j].size(); i++)
+        if (rows[j][i] == 'O' || rows[j][i] == '*') bitmap.set(i, j);
+    return w > 0;
+  }
+
+  bool load(const std::string& path, Bitmap& bitmap, std::string& rule)
+  {
+    std::ifstream in{ path };
+    if (!in) return false;
+
+    const bool rle = path.size() >= 4 && path.compare(path.size() - 4, 4, ".rle") == 0;
+    return rle ? loadRle(in, bitmap, rule) : loadPlaintext(in, bitmap);
+  }
+
+  Bitmap randomGrid(const Options& o)
+  {
+    Bitmap bitmap(0, 0, o.width, o.height);
+    std::mt19937_64 random{ o.seed };
+    std::bernoulli_distribution alive{ o.density };
+    for (std::size_t j = 0; j < o.height; j++)
+      for (std::size_t i = 0; i < o.width; i++)
+        if (alive(random)) bitmap.set(i, j);
+    return bitmap;
+  }
+
+  // Centres the pattern in a grid of the requested size
+  Bitmap place(const Bitmap& pattern, const Options& o)
+  {
+    Bitmap bitmap(0, 0, o.width, o.height);
+    const auto left = static_cast<std::int64_t>(o.width - pattern.w) / 2;
+    const auto top = static_cast<std::int64_t>(o.height - pattern.h) / 2;
+    for (std::size_t j = 0; j < pattern.h; j++)
+      for (std::size_t i = 0; i < pattern.w; i += 64)
+        bitmap.write(left + i, top + j, pattern.read(i, j));
+    return bitmap;
+  }
+
+  // Most memory the process has held at once, in KiB
+  std::uint64_t peakRss()
+  {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return counters.PeakWorkingSetSize / 1024;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage)) return 0;
+#if defined(__APPLE__)
+    return static_cast<std::uint64_t>(usage.ru_maxrss) / 1024; // bytes there
+#else
+    return static_cast<std::uint64_t>(usage.ru_maxrss);
+#endif
+#endif
+  }
+
+  // Nearest rank percentile of sorted latencies
+  double percentile(const std::vector<double>& sorted, double p)
+  {
+    if (sorted.empty()) return 0;
+    const auto rank = static_cast<std::size_t>(p / 100 * sorted.size() + .999999);
+    return sorted[std::min(sorted.size(), std::max<std::size_t>(rank, 1)) - 1];
+  }
+}
+
+int main(int argc, char** argv)
+{
+  Options o;
+  if (!parseOptions(argc, argv, o))
+  {
+    usage();
+    return 1;
+  }
+
+  auto engine = makeEngine(o);
+  if (!engine)
+  {
+    std::fprintf(stderr, "unknown engine or kernel\n");
+    return 1;
+  }
+
+  engine->setThreadCount(o.threads);
+
+  Cells* const cells = o.engine == "cells" || o.engine == "events" ? static_cast<Cells*>(engine.get()) : nullptr;
+  if (!o.file.empty() && !cells)
+  {
+    std::fprintf(stderr, "only cells and events can keep the grid in a file\n");
+    return 1;
+  }
+
+  // A grid file from an earlier run is carried on from, with its own size and rule
+  if (cells && !o.file.empty() && cells->openFile(o.file))
+  {
+    o.width = cells->getWidth();
+    o.height = cells->getHeight();
+    Rule rule;
+    if (!o.rule.empty() && !Rule::parse(o.rule, rule))
+    {
+      std::fprintf(stderr, "can't run rule %s\n", o.rule.c_str());
+      return 1;
+    }
+    if (!o.rule.empty()) cells->setRule(rule);
+    if (o.torus) cells->setTorus(true);
+  }
+  else
+  {
+    Bitmap grid;
+    std::string patternRule;
+    if (!o.load.empty())
+    {
+      Bitmap pattern;
+      if (!load(o.load, pattern, patternRule))
+      {
+        std::fprintf(stderr, "can't read pattern %s\n", o.load.c_str());
+        return 1;
+      }
+      if (pattern.w > o.width || pattern.h > o.height)
+      {
+        std::fprintf(stderr, "pattern is %zux%zu, bigger than the grid\n", pattern.w, pattern.h);
+        return 1;
+      }
+      grid = place(pattern, o);
+    }
+    else grid = randomGrid(o);
+
+    Rule rule;
+    if (!o.rule.empty() && !Rule::parse(o.rule, rule))
+    {
+      std::fprintf(stderr, "can't run rule %s\n", o.rule.c_str());
+      return 1;
+    }
+    if (o.rule.empty() && !patternRule.empty() && !Rule::parse(patternRule, rule))
+      std::fprintf(stderr, "pattern rule %s isn't supported, running B3/S23\n", patternRule.c_str());
+
+    engine->setRule(rule);
+    engine->setTorus(o.torus);
+    if (cells && !o.file.empty())
+    {
+      if (!cells->createFile(o.file, o.width, o.height))
+      {
+        std::fprintf(stderr, "can't make grid file %s\n", o.file.c_str());
+        return 1;
+      }
+    }
+    else engine->setDimensions(o.width, o.height);
+    engine->importBitmap(grid);
+  }
+
+  engine->step(o.warmup);
+
+  using Clock = std::chrono::steady_clock;
+  std::vector<double> latencies; // milliseconds
+  latencies.reserve(o.updates);
+
+  const auto start = Clock::now();
+  for (std::uint64_t n = 0; n < o.updates; n++)
+  {
+    const auto before = Clock::now();
+    if (o.batch > 1) engine->step(o.batch);
+    else engine->nextGen();
+    latencies.push_back(std::chrono::duration<double, std::milli>(Clock::now() - before).count());
+  }
+  const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  std::sort(latencies.begin(), latencies.end());
+
+  const int exponent = o.engine == "hashlife" ? o.stepExponent : 0;
+  const double generations = static_cast<double>(o.updates) * static_cast<double>(o.batch)
+    * static_cast<double>(std::uint64_t{ 1 } << exponent);
+  const double area = static_cast<double>(o.width) * static_cast<double>(o.height);
+  const double gensPerSec = seconds > 0 ? generations / seconds : 0;
+
+  const std::string ruleText = engine->getRule().toString();
+  const char* const kernel = kernelName(*engine, o);
+  const bool torus = engine->isTorus();
+  const auto population = static_cast<unsigned long long>(engine->population());
+  const auto rss = static_cast<unsigned long long>(peakRss());
+
+  if (o.format == "json")
+  {
+    std::printf("{\"engine\":\"%s\",\"kernel\":\"%s\",\"width\":%zu,\"height\":%zu,\"density\":%g,"
+      "\"pattern\":\"%s\",\"rule\":\"%s\",\"torus\":%s,\"threads\":%zu,\"updates\":%llu,\"generations\":%.0f,"
+      "\"seconds\":%.6f,\"gens_per_sec\":%.3f,\"cell_updates_per_sec\":%.0f,"
+      "\"p50_ms\":%.4f,\"p90_ms\":%.4f,\"p99_ms\":%.4f,\"max_ms\":%.4f,"
+      "\"peak_rss_kib\":%llu,\"population\":%llu}\n",
+      o.engine.c_str(), kernel, o.width, o.height, o.load.empty() ? o.density : 0, o.load.c_str(),
+      ruleText.c_str(), torus ? "true" : "false", o.threads, static_cast<unsigned long long>(o.updates), generations,
+      seconds, gensPerSec, gensPerSec * area,
+      percentile(latencies, 50), percentile(latencies, 90), percentile(latencies, 99), percentile(latencies, 100),
+      rss, population);
+  }
+  else
+  {
+    if (o.header)
+      std::printf("engine,kernel,width,height,density,pattern,rule,torus,threads,updates,generations,"
+        "seconds,gens_per_sec,cell_updates_per_sec,p50_ms,p90_ms,p99_ms,max_ms,peak_rss_kib,population\n");
+    std::printf("%s,%s,%zu,%zu,%g,%s,%s,%d,%zu,%llu,%.0f,%.6f,%.3f,%.0f,%.4f,%.4f,%.4f,%.4f,%llu,%llu\n",
+      o.engine.c_str(), kernel, o.width, o.height, o.load.empty() ? o.density : 0, o.load.c_str(),
+      ruleText.c_str(), torus ? 1 : 0, o.threads, static_cast<unsigned long long>(o.updates), generations,
+      seconds, gensPerSec, gensPerSec * area,
+      percentile(latencies, 50), percentile(latencies, 90), percentile(latencies, 99), percentile(latencies, 100),
+      rss, population);
+  }
+
+  return 0;
+}
@@ -0,0 +1,273 @@
+#ifndef BITCELLS_H
+#define BITCELLS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "LifeEngine.h"
+
+// Bit-packed alternative to Cells.
+// Every cell is a single bit and a row is stored as 64 bit words,
+// so the next generation is found for 64 cells at a time by adding up
+// the neighbours of the whole word with bitwise full adders.
+// Exposes the same interface as Cells so the two are interchangeable.
+struct BitCells : public LifeEngine
+{
+  BitCells() :words{ nullptr }, words2{ nullptr }, exists{ false }, w{ 0 }, h{ 0 }, stride{ 0 } {}
+  BitCells(std::size_t i) :BitCells()
+  {
+    setDimensions(i, i);
+  }
+  BitCells(std::size_t i, std::size_t j) :BitCells()
+  {
+    setDimensions(i, j);
+  }
+
+  ~BitCells()
+  {
+    destroy();
+  }
+
+  void setCell(std::int64_t i, std::int64_t j) override
+  {
+    *word(i, j) |= bit(i);
+  }
+
+  void unsetCell(std::int64_t i, std::int64_t j) override
+  {
+    *word(i, j) &= ~bit(i);
+  }
+
+  bool isAlive(std::int64_t i, std::int64_t j) const override
+  {
+    return words[(j + 1) * stride + i / 64 + 1] & bit(i);
+  }
+
+  void nextGen() override
+  {
+    const std::size_t wordsPerRow = stride - 2;
+
+    // Bits of the last word that are past the right edge must stay dead
+    const std::uint64_t lastMask = w % 64 ? (std::uint64_t{ 1 } << (w % 64)) - 1 : ~std::uint64_t{ 0 };
+    const bool conway = rule == Rules::conway;
+
+    for (std::size_t y = 1; y <= h; y++)
+    {
+      const std::uint64_t* above = words + (y - 1) * stride + 1;
+      const std::uint64_t* row = words + y * stride + 1;
+      const std::uint64_t* below = words + (y + 1) * stride + 1;
+      std::uint64_t* next = words2 + y * stride + 1;
+
+      if (conway)
+        for (std::size_t k = 0; k < wordsPerRow; k++)
+          next[k] = step(above + k, row + k, below + k);
+      else
+        for (std::size_t k = 0; k < wordsPerRow; k++)
+          next[k] = step(above + k, row + k, below + k, rule);
+
+      next[wordsPerRow - 1] &= lastMask;
+    }
+
+    // Swap arrays because words2 now contains next gen
+    auto temp = words;
+    words = words2;
+    words2 = temp;
+  }
+
+  void setDimensions(std::size_t i, std::size_t j) override
+  {
+    destroy();
+    exists = true;
+    w = i;
+    h = j;
+
+    // +2 words per row and +2 rows of dead cells so that
+    // the neighbours of the edge words can be read without conditionals
+    stride = (i + 63) / 64 + 2;
+    words = new std::uint64_t[stride * (j + 2)];
+    words2 = new std::uint64_t[stride * (j + 2)];
+    clear();
+  }
+
+  void setDimensions(std::size_t i)
+  {
+    setDimensions(i, i);
+  }
+
+  std::size_t getWidth() const override
+  {
+    return w;
+  }
+
+  std::size_t getHeight() const override
+  {
+    return h;
+  }
+
+  void destroy() override
+  {
+    if (!exists) return;
+
+    delete[] words;
+    delete[] words2;
+    exists = false;
+  }
+
+  void clear() override
+  {
+    if (!exists) return;
+
+    std::memset(words, 0, stride * (h + 2) * sizeof(std::uint64_t));
+    std::memset(words2, 0, stride * (h + 2) * sizeof(std::uint64_t));
+  }
+
+  bool exist() const override
+  {
+    return exists;
+  }
+
+  void forEachLive(const std::function<void(std::int64_t, std::int64_t)>& f) const override
+  {
+    if (!exists) return;
+
+    for (std::size_t j = 0; j < h; j++)
+      for (std::size_t k = 0; k + 2 < stride; k++)
+        forEachBit(words[(j + 1) * stride + k + 1], [&](int b) { f(k * 64 + b, j); });
+  }
+
+  std::uint64_t population() const override
+  {
+    if (!exists) return 0;
+
+    std::uint64_t n{ 0 };
+    for (std::size_t j = 1; j <= h; j++)
+      for (std::size_t k = 1; k + 1 < stride; k++)
+        n += popcount(words[j * stride + k]);
+    return n;
+  }
+
+  // Both sides store rows of bits so whole words are copied
+  Bitmap exportBitmap(std::int64_t left, std::int64_t top, std::size_t width, std::size_t height) const override
+  {
+    Bitmap bitmap(left, top, width, height);
+    if (!exists) return bitmap;
+
+    for (std::size_t j = 0; j < h; j++)
+      for (std::size_t k = 0; k + 2 < stride; k++)
+        bitmap.write(k * 64, j, words[(j + 1) * stride + k + 1]);
+    return bitmap;
+  }
+
+  void importBitmap(const Bitmap& bitmap) override
+  {
+    clear();
+    if (!exists) return;
+
+    const std::size_t wordsPerRow = stride - 2;
+    const std::uint64_t lastMask = w % 64 ? (std::uint64_t{ 1 } << (w % 64)) - 1 : ~std::uint64_t{ 0 };
+    for (std::size_t j = 0; j < h; j++)
+    {
+      for (std::size_t k = 0; k < wordsPerRow; k++)
+        *word(k * 64, j) = bitmap.read(k * 64, j);
+      *word((wordsPerRow - 1) * 64, j) &= lastMask;
+    }
+  }
+
+  // Next generation of the 64 cells in *row.
+  // Each pointer points to a word and its left and right words are read as well.
+  static std::uint64_t step(const std::uint64_t* above, const std::uint64_t* row, const std::uint64_t* below)
+  {
+    // Bit x of a cell's west neighbour is bit x - 1, so shift left
+    // and bring in the top bit of the word to the left (and vice versa for east)
+    const std::uint64_t aW = (*above << 1) | (above[-1] >> 63);
+    const std::uint64_t aE = (*above >> 1) | (above[1] << 63);
+    const std::uint64_t bW = (*row << 1) | (row[-1] >> 63);
+    const std::uint64_t bE = (*row >> 1) | (row[1] << 63);
+    const std::uint64_t cW = (*below << 1) | (below[-1] >> 63);
+    const std::uint64_t cE = (*below >> 1) | (below[1] << 63);
+
+    // Add up each row, giving a two bit count per row
+    const std::uint64_t aOnes = aW ^ *above ^ aE;
+    const std::uint64_t aTwos = (aW & *above) | (aE & (aW ^ *above));
+    const std::uint64_t bOnes = bW ^ bE;
+    const std::uint64_t bTwos = bW & bE;
+    const std::uint64_t cOnes = cW ^ *below ^ cE;
+    const std::uint64_t cTwos = (cW & *below) | (cE & (cW ^ *below));
+
+    // Add the ones of the three rows
+    const std::uint64_t ones = aOnes ^ bOnes ^ cOnes;
+    const std::uint64_t carry = (aOnes & bOnes) | (cOnes & (aOnes ^ bOnes));
+
+    // The count is 2 or 3 only if exactly one of the twos and the carry is set
+    const std::uint64_t p1 = aTwos ^ bTwos, q1 = aTwos & bTwos;
+    const std::uint64_t p2 = cTwos ^ carry, q2 = cTwos & carry;
+    const std::uint64_t twoOrThree = (p1 ^ p2) & ~(q1 | q2);
+
+    // Three neighbours or alive with two
+    return twoOrThree & (ones | *row);
+  }
+
+  // The same for any rule. The neighbours are added up into four bit counts
+  // and every count the rule cares about is compared against.
+  static std::uint64_t step(const std::uint64_t* above, const std::uint64_t* row, const std::uint64_t* below, const Rule& rule)
+  {
+    const std::uint64_t aW = (*above << 1) | (above[-1] >> 63);
+    const std::uint64_t aE = (*above >> 1) | (above[1] << 63);
+    const std::uint64_t bW = (*row << 1) | (row[-1] >> 63);
+    const std::uint64_t bE = (*row >> 1) | (row[1] << 63);
+    const std::uint64_t cW = (*below << 1) | (below[-1] >> 63);
+    const std::uint64_t cE = (*below >> 1) | (below[1] << 63);
+
+    const std::uint64_t aOnes = aW ^ *above ^ aE;
+    const std::uint64_t aTwos = (aW & *above) | (aE & (aW ^ *above));
+    const std::uint64_t bOnes = bW ^ bE;
+    const std::uint64_t bTwos = bW & bE;
+    const std::uint64_t cOnes = cW ^ *below ^ cE;
+    const std::uint64_t cTwos = (cW & *below) | (cE & (cW ^ *below));
+
+    const std::uint64_t ones = aOnes ^ bOnes ^ cOnes;
+    const std::uint64_t carry = (aOnes & bOnes) | (cOnes & (aOnes ^ bOnes));
+
+    // Add the four bits worth two, which is at most four
+    const std::uint64_t p = aTwos ^ bTwos, q = cTwos ^ carry;
+    const std::uint64_t c1 = aTwos & bTwos, c2 = cTwos & carry, c3 = p & q;
+    const std::uint64_t twos = p ^ q;
+    const std::uint64_t fours = c1 ^ c2 ^ c3;
+    const std::uint64_t eights = (c1 & c2) | (c3 & (c1 ^ c2));
+
+    std::uint64_t born{ 0 }, survives{ 0 };
+    for (int n = 0; n <= 8; n++)
+    {
+      if (!((rule.birth | rule.survival) >> n & 1)) continue;
+
+      const std::uint64_t count = (n & 1 ? ones : ~ones) & (n & 2 ? twos : ~twos)
+        & (n & 4 ? fours : ~fours) & (n & 8 ? eights : ~eights);
+      if (rule.birth >> n & 1) born |= count;
+      if (rule.survival >> n & 1) survives |= count;
+    }
+
+    return (born & ~*row) | (survives & *row);
+  }
+
+private:
+  static std::uint64_t bit(std::size_t i)
+  {
+    return std::uint64_t{ 1 } << (i % 64);
+  }
+
+  std::uint64_t* word(std::size_t i, std::size_t j)
+  {
+    return words + (j + 1) * stride + i / 64 + 1;
+  }
+
+  // First word of every row and the first and last rows are dead buffers
+  std::uint64_t* words;
+  std::uint64_t* words2;
+  bool exists;
+  std::size_t w;
+  std::size_t h;
+  std::size_t stride;
+};
+
+#endif
@@ -0,0 +1,492 @@
+#ifndef CELLKERNELS_H
+#define CELLKERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Rule.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CELLKERNELS_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// MSVC lets any function use any intrinsic, gcc and clang need to be told
+#if defined(CELLKERNELS_X86) && defined(__GNUC__)
+#define CELLKERNELS_TARGET(isa) __attribute__((target(isa)))
+#else
+#define CELLKERNELS_TARGET(isa)
+#endif
+
+// Kernels that compute the next generation of Cells from neighbour sums.
+// Instead of informing the neighbours of every cell like Cells::setCell does,
+// each cell of the next generation is gathered from the 3x3 block around it:
+// a cell lives next generation if bit <byte> of the rule's transitions is set
+// (for Conway that's a byte of 5, alive with 2 neighbours, 6 or 7, 3 neighbours),
+// and its neighbour count is the sum of that over its eight neighbours.
+// Every cell only writes its own byte so there are no branches and
+// 16, 32 or 64 cells are done per step.
+//
+// The kernels are templates on the rule's transitions. Conway checks for
+// bytes 5 to 7 with a single compare, other rules look the bytes up in a table.
+// The common rules get their own kernels with the table built in and any
+// other rule uses Mask 0 which reads the transitions passed at run time.
+namespace CellKernels
+{
+  enum class Type
+  {
+    scalar, sse2, avx2, avx512
+  };
+
+  // Cells of a span that came alive and that died, added to by the kernels
+  struct Tally
+  {
+    std::size_t births{ 0 };
+    std::size_t deaths{ 0 };
+  };
+
+  // Computes n cells of a row starting at cur into next.
+  // stride is the distance between rows and the cells surrounding
+  // the span must be readable, with dead cells reading as 0.
+  // Returns true if any byte differs from what was in next before, which is
+  // the generation before cur, so still lifes and blinkers count as unchanged.
+  // rule is the transitions of the rule, only read by kernels made for any rule.
+  // The cells born and died are added to tally, unless the kernel is one made not to count them.
+  using Span = bool (*)(const unsigned char* cur, unsigned char* next, std::size_t stride, std::size_t n, std::uint32_t rule, Tally& tally);
+
+  constexpr std::uint32_t conway = Rules::conway.transitions();
+
+  template <std::uint32_t Mask>
+  inline unsigned char lives(unsigned char cell, std::uint32_t rule)
+  {
+    if (Mask == conway) return static_cast<unsigned char>(cell - 5) < 3;
+    return (Mask ? Mask : rule) >> cell & 1;
+  }
+
+  template <std::uint32_t Mask, bool Count>
+  inline bool stepScalar(const unsigned char* cur, unsigned char* next, std::size_t stride, std::size_t n, std::uint32_t rule, Tally& tally)
+  {
+    unsigned char changed{ 0 };
+    for (std::size_t i = 0; i < n; i++)
+    {
+      const unsigned char* const c = cur + i;
+      const auto l = [rule](unsigned char cell) { return lives<Mask>(cell, rule); };
+      const unsigned int neighbours = l(*(c - stride - 1)) + l(*(c - stride)) + l(*(c - stride + 1))
+        + l(*(c - 1)) + l(*(c + 1))
+        + l(*(c + stride - 1)) + l(*(c + stride)) + l(*(c + stride + 1));
+      const unsigned char alive = l(*c);
+      if (Count)
+      {
+        tally.births += alive > (*c & 0x01);
+        tally.deaths += alive < (*c & 0x01);
+      }
+      const auto cell = static_cast<unsigned char>(alive | neighbours << 1);
+      changed |= next[i] ^ cell;
+      next[i] = cell;
+    }
+    return changed;
+  }
+
+#ifdef CELLKERNELS_X86
+  // The kernels count births and deaths a byte per cell, adding up the bytes
+  // eight at a time with a sum of absolute differences against zero.
+  // The byte counts have to be added up before any could pass 255,
+  // then no sum of eight is over 16 bits, so deaths can share a sum with births
+  // in its top 32 bits and both are added across the vector in one go.
+  constexpr std::size_t countLimit{ 255 };
+
+  CELLKERNELS_TARGET("sse2") inline void addSums(Tally& tally, __m128i sums)
+  {
+    sums = _mm_add_epi64(sums, _mm_unpackhi_epi64(sums, sums));
+
+    std::uint64_t both;
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(&both), sums);
+    tally.births += static_cast<std::size_t>(both & 0xFFFFFFFF);
+    tally.deaths += static_cast<std::size_t>(both >> 32);
+  }
+
+  CELLKERNELS_TARGET("sse2") inline void addTally(Tally& tally, __m128i births, __m128i deaths)
+  {
+    const __m128i zero = _mm_setzero_si128();
+    addSums(tally, _mm_add_epi64(_mm_sad_epu8(births, zero), _mm_slli_epi64(_mm_sad_epu8(deaths, zero), 32)));
+  }
+
+  // SSE2 can't look bytes up in a table so every byte the rule keeps alive is compared against
+  struct Sse2Rule
+  {
+    __m128i values[18];
+    int count;
+  };
+
+  template <std::uint32_t Mask>
+  CELLKERNELS_TARGET("sse2") inline void makeSse2Rule(Sse2Rule& r, std::uint32_t rule)
+  {
+    const std::uint32_t m = Mask ? Mask : rule;
+    r.count = 0;
+    for (int v = 0; v < 18; v++)
+      if (m >> v & 1) r.values[r.count++] = _mm_set1_epi8(static_cast<char>(v));
+  }
+
+  // 0xFF for every byte that lives next generation
+  template <std::uint32_t Mask>
+  CELLKERNELS_TARGET("sse2") inline __m128i livesSse2(const unsigned char* p, const Sse2Rule& r)
+  {
+    const __m128i cells = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    if (Mask == conway)
+    {
+      const __m128i t = _mm_sub_epi8(cells, _mm_set1_epi8(5));
+      return _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(2)), t);
+    }
+
+    __m128i l = _mm_setzero_si128();
+    for (int k = 0; k < r.count; k++) l = _mm_or_si128(l, _mm_cmpeq_epi8(cells, r.values[k]));
+    return l;
+  }
+
+  template <std::uint32_t Mask, bool Count>
+  CELLKERNELS_TARGET("sse2") inline bool stepSse2(const unsigned char* cur, unsigned char* next, std::size_t stride, std::size_t n, std::uint32_t rule, Tally& tally)
+  {
+    const __m128i one = _mm_set1_epi8(1);
+    __m128i changed = _mm_setzero_si128();
+    __m128i births = _mm_setzero_si128(), deaths = _mm_setzero_si128();
+    std::size_t counted{ 0 };
+
+    Sse2Rule r;
+    if (Mask != conway) makeSse2Rule<Mask>(r, rule);
+
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+      const unsigned char* const c = cur + i;
+
+      // Every mask is -1 so subtracting them counts the neighbours
+      __m128i neighbours = _mm_setzero_si128();
+      neighbours = _mm_sub_epi8(neighbours, livesSse2<Mask>(c - stride - 1, r));
+      neighbours = _mm_sub_epi8(neighbours, livesSse2<Mask>(c - stride, r));
+      neighbours = _mm_sub_epi8(neighbours, livesSse2<Mask>(c - stride + 1, r));
+      neighbours = _mm_sub_epi8(neighbours, livesSse2<Mask>(c - 1, r));
+      neighbours = _mm_sub_epi8(neighbours, livesSse2<Mask>(c + 1, r));
+      neighbours = _mm_sub_epi8(neighbours, livesSse2<Mask>(c + stride - 1, r));
+      neighbours = _mm_sub_epi8(neighbours, livesSse2<Mask>(c + stride, r));
+      neighbours = _mm_sub_epi8(neighbours, livesSse2<Mask>(c + stride + 1, r));
+
+      const __m128i alive = _mm_and_si128(livesSse2<Mask>(c, r), one);
+      if (Count)
+      {
+        const __m128i was = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(c)), one);
+        births = _mm_add_epi8(births, _mm_andnot_si128(was, alive));
+        deaths = _mm_add_epi8(deaths, _mm_andnot_si128(alive, was));
+        if (++counted == countLimit)
+        {
+          addTally(tally, births, deaths);
+          births = deaths = _mm_setzero_si128();
+          counted = 0;
+        }
+      }
+
+      const __m128i cells = _mm_or_si128(alive, _mm_add_epi8(neighbours, neighbours));
+      __m128i* const out = reinterpret_cast<__m128i*>(next + i);
+      changed = _mm_or_si128(changed, _mm_xor_si128(cells, _mm_loadu_si128(out)));
+      _mm_storeu_si128(out, cells);
+    }
+    if (Count) addTally(tally, births, deaths);
+    const bool tailChanged = stepScalar<Mask, Count>(cur + i, next + i, stride, n - i, rule, tally);
+    return tailChanged || _mm_movemask_epi8(_mm_cmpeq_epi8(changed, _mm_setzero_si128())) != 0xFFFF;
+  }
+
+  // Bytes 0 to 15 are looked up with a byte shuffle. Adding 0x70 with saturation
+  // keeps the low four bits of those and sets the top bit of 16 and 17,
+  // which the shuffle turns into 0, so those two are compared against instead.
+  inline void shuffleTable(unsigned char table[16], std::uint32_t m)
+  {
+    for (int v = 0; v < 16; v++) table[v] = m >> v & 1 ? 0xFF : 0;
+  }
+
+  CELLKERNELS_TARGET("avx2") inline void addTally(Tally& tally, __m256i births, __m256i deaths)
+  {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i sums = _mm256_add_epi64(_mm256_sad_epu8(births, zero), _mm256_slli_epi64(_mm256_sad_epu8(deaths, zero), 32));
+    addSums(tally, _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1)));
+  }
+
+  struct Avx2Rule
+  {
+    __m256i table;
+    bool sixteen;
+    bool seventeen;
+  };
+
+  template <std::uint32_t Mask>
+  CELLKERNELS_TARGET("avx2") inline void makeAvx2Rule(Avx2Rule& r, std::uint32_t rule)
+  {
+    const std::uint32_t m = Mask ? Mask : rule;
+    unsigned char table[16];
+    shuffleTable(table, m);
+    r.table = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(table)));
+    r.sixteen = m >> 16 & 1;
+    r.seventeen = m >> 17 & 1;
+  }
+
+  template <std::uint32_t Mask>
+  CELLKERNELS_TARGET("avx2") inline __m256i livesAvx2(const unsigned char* p, const Avx2Rule& r)
+  {
+    const __m256i cells = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    if (Mask == conway)
+    {
+      const __m256i t = _mm256_sub_epi8(cells, _mm256_set1_epi8(5));
+      return _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(2)), t);
+    }
+
+    __m256i l = _mm256_shuffle_epi8(r.table, _mm256_adds_epu8(cells, _mm256_set1_epi8(0x70)));
+    if (r.sixteen) l = _mm256_or_si256(l, _mm256_cmpeq_epi8(cells, _mm256_set1_epi8(16)));
+    if (r.seventeen) l = _mm256_or_si256(l, _mm256_cmpeq_epi8(cells, _mm256_set1_epi8(17)));
+    return l;
+  }
+
+  template <std::uint32_t Mask, bool Count>
+  CELLKERNELS_TARGET("avx2") inline bool stepAvx2(const unsigned char* cur, unsigned char* next, std::size_t stride, std::size_t n, std::uint32_t rule, Tally& tally)
+  {
+    const __m256i one = _mm256_set1_epi8(1);
+    __m256i changed = _mm256_setzero_si256();
+    __m256i births = _mm256_setzero_si256(), deaths = _mm256_setzero_si256();
+    std::size_t counted{ 0 };
+
+    Avx2Rule r;
+    if (Mask != conway) makeAvx2Rule<Mask>(r, rule);
+
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+      const unsigned char* const c = cur + i;
+
+      __m256i neighbours = _mm256_setzero_si256();
+      neighbours = _mm256_sub_epi8(neighbours, livesAvx2<Mask>(c - stride - 1, r));
+      neighbours = _mm256_sub_epi8(neighbours, livesAvx2<Mask>(c - stride, r));
+      neighbours = _mm256_sub_epi8(neighbours, livesAvx2<Mask>(c - stride + 1, r));
+      neighbours = _mm256_sub_epi8(neighbours, livesAvx2<Mask>(c - 1, r));
+      neighbours = _mm256_sub_epi8(neighbours, livesAvx2<Mask>(c + 1, r));
+      neighbours = _mm256_sub_epi8(neighbours, livesAvx2<Mask>(c + stride - 1, r));
+      neighbours = _mm256_sub_epi8(neighbours, livesAvx2<Mask>(c + stride, r));
+      neighbours = _mm256_sub_epi8(neighbours, livesAvx2<Mask>(c + stride + 1, r));
+
+      const __m256i alive = _mm256_and_si256(livesAvx2<Mask>(c, r), one);
+      if (Count)
+      {
+        const __m256i was = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(c)), one);
+        births = _mm256_add_epi8(births, _mm256_andnot_si256(was, alive));
+        deaths = _mm256_add_epi8(deaths, _mm256_andnot_si256(alive, was));
+        if (++counted == countLimit)
+        {
+          addTally(tally, births, deaths);
+          births = deaths = _mm256_setzero_si256();
+          counted = 0;
+        }
+      }
+
+      const __m256i cells = _mm256_or_si256(alive, _mm256_add_epi8(neighbours, neighbours));
+      __m256i* const out = reinterpret_cast<__m256i*>(next + i);
+      changed = _mm256_or_si256(changed, _mm256_xor_si256(cells, _mm256_loadu_si256(out)));
+      _mm256_storeu_si256(out, cells);
+    }
+    if (Count) addTally(tally, births, deaths);
+    const bool tailChanged = stepSse2<Mask, Count>(cur + i, next + i, stride, n - i, rule, tally);
+    return tailChanged || !_mm256_testz_si256(changed, changed);
+  }
+
+  CELLKERNELS_TARGET("avx512f,avx512bw") inline void addTally(Tally& tally, __m512i births, __m512i deaths)
+  {
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i sums = _mm512_add_epi64(_mm512_sad_epu8(births, zero), _mm512_slli_epi64(_mm512_sad_epu8(deaths, zero), 32));
+    const auto both = static_cast<std::uint64_t>(_mm512_reduce_add_epi64(sums));
+    tally.births += static_cast<std::size_t>(both & 0xFFFFFFFF);
+    tally.deaths += static_cast<std::size_t>(both >> 32);
+  }
+
+  struct Avx512Rule
+  {
+    __m512i table;
+    bool sixteen;
+    bool seventeen;
+  };
+
+  template <std::uint32_t Mask>
+  CELLKERNELS_TARGET("avx512f,avx512bw") inline void makeAvx512Rule(Avx512Rule& r, std::uint32_t rule)
+  {
+    const std::uint32_t m = Mask ? Mask : rule;
+    unsigned char table[16];
+    shuffleTable(table, m);
+    r.table = _mm512_broadcast_i32x4(_mm_loadu_si128(reinterpret_cast<const __m128i*>(table)));
+    r.sixteen = m >> 16 & 1;
+    r.seventeen = m >> 17 & 1;
+  }
+
+  // AVX-512 compares straight into mask registers
+  template <std::uint32_t Mask>
+  CELLKERNELS_TARGET("avx512f,avx512bw") inline __mmask64 livesAvx512(const unsigned char* p, const Avx512Rule& r)
+  {
+    const __m512i cells = _mm512_loadu_si512(p);
+    if (Mask == conway)
+      return _mm512_cmple_epu8_mask(_mm512_sub_epi8(cells, _mm512_set1_epi8(5)), _mm512_set1_epi8(2));
+
+    const __m512i found = _mm512_shuffle_epi8(r.table, _mm512_adds_epu8(cells, _mm512_set1_epi8(0x70)));
+    __mmask64 l = _mm512_test_epi8_mask(found, found);
+    if (r.sixteen) l |= _mm512_cmpeq_epi8_mask(cells, _mm512_set1_epi8(16));
+    if (r.seventeen) l |= _mm512_cmpeq_epi8_mask(cells, _mm512_set1_epi8(17));
+    return l;
+  }
+
+  template <std::uint32_t Mask, bool Count>
+  CELLKERNELS_TARGET("avx512f,avx512bw") inline bool stepAvx512(const unsigned char* cur, unsigned char* next, std::size_t stride, std::size_t n, std::uint32_t rule, Tally& tally)
+  {
+    const __m512i one = _mm512_set1_epi8(1);
+    __mmask64 changed{ 0 };
+    __m512i births = _mm512_setzero_si512(), deaths = _mm512_setzero_si512();
+    std::size_t counted{ 0 };
+
+    Avx512Rule r;
+    if (Mask != conway) makeAvx512Rule<Mask>(r, rule);
+
+    std::size_t i = 0;
+    for (; i + 64 <= n; i += 64)
+    {
+      const unsigned char* const c = cur + i;
+
+      __m512i neighbours = _mm512_setzero_si512();
+      neighbours = _mm512_mask_add_epi8(neighbours, livesAvx512<Mask>(c - stride - 1, r), neighbours, one);
+      neighbours = _mm512_mask_add_epi8(neighbours, livesAvx512<Mask>(c - stride, r), neighbours, one);
+      neighbours = _mm512_mask_add_epi8(neighbours, livesAvx512<Mask>(c - stride + 1, r), neighbours, one);
+      neighbours = _mm512_mask_add_epi8(neighbours, livesAvx512<Mask>(c - 1, r), neighbours, one);
+      neighbours = _mm512_mask_add_epi8(neighbours, livesAvx512<Mask>(c + 1, r), neighbours, one);
+      neighbours = _mm512_mask_add_epi8(neighbours, livesAvx512<Mask>(c + stride - 1, r), neighbours, one);
+      neighbours = _mm512_mask_add_epi8(neighbours, livesAvx512<Mask>(c + stride, r), neighbours, one);
+      neighbours = _mm512_mask_add_epi8(neighbours, livesAvx512<Mask>(c + stride + 1, r), neighbours, one);
+
+      const __m512i alive = _mm512_maskz_mov_epi8(livesAvx512<Mask>(c, r), one);
+      if (Count)
+      {
+        const __m512i was = _mm512_and_si512(_mm512_loadu_si512(c), one);
+        births = _mm512_add_epi8(births, _mm512_andnot_si512(was, alive));
+        deaths = _mm512_add_epi8(deaths, _mm512_andnot_si512(alive, was));
+        if (++counted == countLimit)
+        {
+          addTally(tally, births, deaths);
+          births = deaths = _mm512_setzero_si512();
+          counted = 0;
+        }
+      }
+
+      const __m512i cells = _mm512_or_si512(alive, _mm512_add_epi8(neighbours, neighbours));
+      changed |= _mm512_cmpneq_epi8_mask(cells, _mm512_loadu_si512(next + i));
+      _mm512_storeu_si512(next + i, cells);
+    }
+    if (Count) addTally(tally, births, deaths);
+    const bool tailChanged = stepAvx2<Mask, Count>(cur + i, next + i, stride, n - i, rule, tally);
+    return tailChanged || changed;
+  }
+
+  inline void cpuid(int info[4], int leaf, int subleaf)
+  {
+#if defined(_MSC_VER)
+    __cpuidex(info, leaf, subleaf);
+#else
+    unsigned int a, b, c, d;
+    __cpuid_count(leaf, subleaf, a, b, c, d);
+    info[0] = a; info[1] = b; info[2] = c; info[3] = d;
+#endif
+  }
+
+  // Which register states the OS saves on context switches
+  inline unsigned long long xgetbv()
+  {
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned int a, d;
+    __asm__ volatile("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return a | static_cast<unsigned long long>(d) << 32;
+#endif
+  }
+#endif
+
+  // The widest kernel this CPU and OS can run
+  inline Type detect()
+  {
+#ifdef CELLKERNELS_X86
+    int info[4];
+    cpuid(info, 0, 0);
+    const int maxLeaf = info[0];
+
+    cpuid(info, 1, 0);
+    const bool sse2 = info[3] & (1 << 26);
+    const bool osxsave = info[2] & (1 << 27);
+    const bool avx = info[2] & (1 << 28);
+    if (!sse2) return Type::scalar;
+    if (!osxsave || !avx || maxLeaf < 7) return Type::sse2;
+
+    const auto xcr0 = xgetbv();
+    const bool ymm = (xcr0 & 0x06) == 0x06;
+    const bool zmm = (xcr0 & 0xE6) == 0xE6;
+
+    cpuid(info, 7, 0);
+    const bool avx2 = info[1] & (1 << 5);
+    const bool avx512f = info[1] & (1 << 16);
+    const bool avx512bw = info[1] & (1 << 30);
+
+    if (zmm && avx512f && avx512bw) return Type::avx512;
+    if (ymm && avx2) return Type::avx2;
+    return Type::sse2;
+#else
+    return Type::scalar;
+#endif
+  }
+
+  inline Type best()
+  {
+    static const Type type = detect();
+    return type;
+  }
+
+  template <std::uint32_t Mask, bool Count>
+  inline Span span(Type type)
+  {
+#ifdef CELLKERNELS_X86
+    switch (type)
+    {
+    case Type::avx512: return stepAvx512<Mask, Count>;
+    case Type::avx2: return stepAvx2<Mask, Count>;
+    case Type::sse2: return stepSse2<Mask, Count>;
+    default: break;
+    }
+#else
+    (void)type;
+#endif
+    return stepScalar<Mask, Count>;
+  }
+
+  template <std::uint32_t Mask>
+  inline Span span(Type type, bool count)
+  {
+    return count ? span<Mask, true>(type) : span<Mask, false>(type);
+  }
+
+  // The kernel for a rule, made for it if it's a common one.
+  // Generations whose births and deaths nobody reads can leave them uncounted.
+  inline Span span(Type type, std::uint32_t rule, bool count = true)
+  {
+    switch (rule)
+    {
+    case conway: return span<conway>(type, count);
+    case Rules::highLife.transitions(): return span<Rules::highLife.transitions()>(type, count);
+    case Rules::dayAndNight.transitions(): return span<Rules::dayAndNight.transitions()>(type, count);
+    case Rules::seeds.transitions(): return span<Rules::seeds.transitions()>(type, count);
+    default: return span<0>(type, count);
+    }
+  }
+}
+
+#endif
@@ -1,20 +1,30 @@
 #ifndef CELLS_H
 #define CELLS_H
 
+#include <algorithm>
 #include <cstddef>
 #include <cstring>
+#include <memory>
+#include <new>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
 #include <iostream>
 
-struct Cells
+#include "CellKernels.h"
+#include "LifeEngine.h"
+#include "Pages.h"
+#include "ThreadPool.h"
+
+struct Cells : public LifeEngine
 {
-  Cells() :exists{ false }, w{ 0 }, h{ 0 }, bda{ nullptr }, bda2{ nullptr } {}
-  Cells(std::size_t i)
+  Cells() :bda{ nullptr }, bda2{ nullptr }, exists{ false }, w{ 0 }, h{ 0 }, kernel{ CellKernels::best() } {}
+  Cells(std::size_t i) :Cells()
   {
     setDimensions(i, i);
   }
-  Cells(std::size_t i, std::size_t j)
+  Cells(std::size_t i, std::size_t j) :Cells()
   {
     setDimensions(i, j);
   }
@@ -24,9 +34,25 @@ struct Cells
     destroy();
   }
 
-  void setCell(const std::size_t& i, const std::size_t& j)
+  void setCell(std::int64_t i, std::int64_t j) override
   {
-    setCell(bda + i + 1 + (j + 1) * (w + 2));
+    unsigned char* const cell = bda + i + 1 + (j + 1) * (w + 2);
+    if (*cell & 0x01) return;
+
+    const std::size_t tile = j / tileSize * tilesX + i / tileSize;
+    changed[tile] = edited;
+    touched[tile] = 1;
+    counts[tile].population++;
+    live++;
+    // An edited grid doesn't go the way it did before
+    if (hashing)
+    {
+      gridHash ^= key(i + 1 + (j + 1) * (w + 2));
+      forgetHistory();
+    }
+    if (torus) borderDirty |= onBorder(i, j);
+    if (eventDriven && !allPending) changes.push_back(i + 1 + (j + 1) * (w + 2));
+    setCell(cell);
   }
 
   void setCell(unsigned char* const cell_ptr)
@@ -47,9 +73,24 @@ struct Cells
     *(cell_ptr - 1 + w + 2) += 0x02; // Cell to my bl
   }
 
-  void unsetCell(const std::size_t& i, const std::size_t& j)
+  void unsetCell(std::int64_t i, std::int64_t j) override
   {
-    unsetCell(bda + i + 1 + (j + 1) * (w + 2));
+    unsigned char* const cell = bda + i + 1 + (j + 1) * (w + 2);
+    if (!(*cell & 0x01)) return;
+
+    const std::size_t tile = j / tileSize * tilesX + i / tileSize;
+    changed[tile] = edited;
+    touched[tile] = 1;
+    counts[tile].population--;
+    live--;
+    if (hashing)
+    {
+      gridHash ^= key(i + 1 + (j + 1) * (w + 2));
+      forgetHistory();
+    }
+    if (torus) borderDirty |= onBorder(i, j);
+    if (eventDriven && !allPending) changes.push_back(i + 1 + (j + 1) * (w + 2));
+    unsetCell(cell);
   }
 
   void unsetCell(unsigned char* const cell_ptr)
@@ -70,13 +111,512 @@ struct Cells
     *(cell_ptr - 1 + w + 2) -= 0x02; // Cell to my bl
   }
 
-  bool isAlive(const std::size_t& i, const std::size_t& j) const
+  bool isAlive(std::int64_t i, std::int64_t j) const override
   {
     return bda[i + 1 + (j + 1) * (w + 2)] & 0x01;
   }
 
-  void nextGen()
+  void nextGen() override
+  {
+    // So a still life is caught after one generation and a blinker after two
+    if (hashing && history.empty()) remember();
+    advance();
+    if (!eventDriven) touchFlipped();
+    generations++;
+    if (hashing) remember();
+  }
+
+  // Several generations at once are run a block of the grid at a time, see nextGensBlocked.
+  // Grids that fit in cache are quicker a whole generation at a time, and so are grids
+  // where only as much as fits in cache changes, since nextGen skips the rest.
+  // Blocks only tell the state at their end, so they aren't used while hashing,
+  // and a file is always gone through a strip of tiles at a time as nextGen streams it.
+  void step(std::uint64_t updates) override
+  {
+    if (eventDriven || hashing || header || !exists || (w + 2) * (h + 2) < blockingBytes)
+    {
+      LifeEngine::step(updates);
+      return;
+    }
+
+    while (updates > 1)
+    {
+      if (changedTiles() * tileSize * tileSize < blockingBytes)
+      {
+        nextGen();
+        updates--;
+        continue;
+      }
+
+      // Odd unless it's the last batch, see nextGensBlocked
+      std::size_t depth = updates < maxDepth ? static_cast<std::size_t>(updates) : maxDepth;
+      if (depth < updates && depth % 2 == 0) depth--;
+      nextGensBlocked(depth);
+      updates -= depth;
+    }
+    if (updates) nextGen();
+  }
+
+  // Blocks, Cells keeps track of which of its tiles changed at all since last time
+  void takeChanges(Bitmap& tiles) override
+  {
+    for (std::size_t ty = 0; ty < tilesY; ty++)
+      for (std::size_t tx = 0; tx < tilesX; tx++)
+        if (touched[ty * tilesX + tx]) tiles.set(static_cast<std::int64_t>(tx), static_cast<std::int64_t>(ty));
+    std::fill(touched.begin(), touched.end(), 0);
+  }
+
+  // Moves on gens generations. Once the grid repeats itself, whole periods don't change it,
+  // so however far that is only what's left over after them is stepped.
+  void skip(std::uint64_t gens)
+  {
+    if (cyclePeriod)
+    {
+      const std::uint64_t jump = gens - gens % cyclePeriod;
+      generations += jump;
+      for (auto& seen : history) seen.generation += jump;
+      if (header) header->generation += jump;
+      gens -= jump;
+    }
+    step(gens);
+  }
+
+  // Use a specific kernel instead of the fastest one the CPU supports.
+  // Kernels the CPU can't run fall back to the fastest one it can.
+  void setKernel(CellKernels::Type k)
+  {
+    kernel = k > CellKernels::best() ? CellKernels::best() : k;
+  }
+
+  CellKernels::Type getKernel() const
+  {
+    return kernel;
+  }
+
+  // Kept up to date as the grid is stepped and edited, so it's never counted
+  std::uint64_t population() const override
+  {
+    return live;
+  }
+
+  // Cells that came alive and that died in the last generation.
+  // After a step of several generations, in the last one of them.
+  std::uint64_t births() const
+  {
+    return born;
+  }
+
+  std::uint64_t deaths() const
+  {
+    return died;
+  }
+
+  // Generations run since the grid was made or cleared
+  std::uint64_t generation() const
+  {
+    return generations;
+  }
+
+  // Keeps a 64 bit hash of the grid up to date, to notice when it starts repeating itself.
+  // It's the keys of the live cells xored together, a key being a mix of the cell's position,
+  // so an edit or a cell that flips changes it by one key. A tile that nextGen skips flips
+  // back the same cells as last generation, so its keys from then are used again.
+  // Finding the keys of the cells that flipped can take as long as the step itself on a busy
+  // grid, though little once it settles, and step doesn't run blocks while it's on.
+  void setHashing(bool on)
+  {
+    if (on == hashing) return;
+
+    hashing = on;
+    forgetHistory();
+    if (!on) return;
+
+    // The tiles' keys from last generation aren't known
+    markAllEdited();
+    rehash();
+  }
+
+  bool isHashing() const
+  {
+    return hashing;
+  }
+
+  std::uint64_t hash() const
+  {
+    return gridHash;
+  }
+
+  // While hashing, how many generations ago the grid was last the same as now, among the
+  // last historyLength, or 0. The grid keeps repeating itself with this period from then on.
+  std::uint64_t period() const
+  {
+    return cyclePeriod;
+  }
+
+  // Instead of going over the whole grid, only look at the cells around the ones
+  // that changed last generation and update the counts of their neighbours in place.
+  // Work follows activity rather than area, so it wins on big grids that are mostly
+  // still, but it's one thread and one cell at a time so busy grids are slower.
+  void setEventDriven(bool on)
+  {
+    if (on == eventDriven) return;
+
+    eventDriven = on;
+    changes.clear();
+    // Neither way knows what the other changed, and bda2 fell behind while events ran
+    markAllEdited();
+  }
+
+  bool isEventDriven() const
+  {
+    return eventDriven;
+  }
+
+  // Number of threads nextGen splits the grid between, 0 for one per hardware thread
+  void setThreadCount(std::size_t n) override
+  {
+    threads = n;
+    if (pool) pool->resize(n);
+  }
+
+  // bda2 was found with the old rule so nothing can be skipped for two generations
+  void setRule(const Rule& r) override
+  {
+    LifeEngine::setRule(r);
+    markAllEdited();
+    forgetHistory();
+    if (header)
+    {
+      header->birth = r.birth;
+      header->survival = r.survival;
+    }
+  }
+
+  // Wraps the grid around into a torus, so what leaves one edge comes back on the other
+  void setTorus(bool on) override
+  {
+    if (on == torus) return;
+
+    torus = on;
+    borderDirty = true;
+    markAllEdited();
+    forgetHistory();
+    if (header) header->torus = on;
+  }
+
+  bool isTorus() const override
+  {
+    return torus;
+  }
+
+  // Keeps the grid in a file instead of memory, for grids bigger than memory.
+  // The OS pages it in and out as nextGen goes through it one strip of tiles at a time.
+  // Between generations the file holds the whole state, rule and edges too,
+  // so it's also a checkpoint that openFile picks up again straight away.
+  // Returns false if the file can't be made, then the grid is left as it was.
+  bool createFile(const std::string& path, std::size_t i, std::size_t j)
+  {
+    unsigned char* const mapped = Pages::mapFile(path, fileBytes(i, j), true);
+    if (!mapped) return false;
+
+    destroy();
+    useFile(mapped, i, j);
+
+    FileHeader& hd = *header;
+    std::memcpy(hd.magic, fileMagic, sizeof(hd.magic));
+    hd.version = fileVersion;
+    hd.flipped = 0;
+    hd.width = i;
+    hd.height = j;
+    hd.generation = 0;
+    hd.birth = rule.birth;
+    hd.survival = rule.survival;
+    hd.torus = torus;
+
+    clear();
+    return true;
+  }
+
+  // Carries on from a file made by createFile.
+  // Returns false if it isn't one, then the grid is left as it was.
+  bool openFile(const std::string& path)
   {
+    const std::size_t size = Pages::fileSize(path);
+    if (size < headerBytes) return false;
+
+    unsigned char* const mapped = Pages::mapFile(path, size, false);
+    if (!mapped) return false;
+
+    const FileHeader& hd = *reinterpret_cast<const FileHeader*>(mapped);
+    if (std::memcmp(hd.magic, fileMagic, sizeof(hd.magic)) || hd.version != fileVersion
+      || hd.width == 0 || hd.height == 0 || fileBytes(hd.width, hd.height) != size)
+    {
+      Pages::unmapFile(mapped, size);
+      return false;
+    }
+
+    destroy();
+    useFile(mapped, static_cast<std::size_t>(hd.width), static_cast<std::size_t>(hd.height));
+    LifeEngine::setRule({ hd.birth, hd.survival });
+    torus = hd.torus != 0;
+
+    // Only the current generation can be trusted, the other buffer may be half done
+    markAllEdited();
+    borderDirty = true;
+    countCells();
+    generations = hd.generation;
+    if (hashing) rehash();
+    forgetHistory();
+    return true;
+  }
+
+  // Waits until the file is up to date on disk, for a checkpoint that survives the machine going down
+  void flushFile()
+  {
+    if (header) Pages::flush(reinterpret_cast<unsigned char*>(header), fileBytes(w, h));
+  }
+
+  bool isFileBacked() const
+  {
+    return header != nullptr;
+  }
+
+  // Generations run since the file was made, 0 without one
+  std::uint64_t fileGeneration() const
+  {
+    return header ? header->generation : 0;
+  }
+
+  std::size_t getThreadCount() const
+  {
+    if (pool) return pool->size();
+    return threads ? threads : ThreadPool::hardwareThreads();
+  }
+
+  void setDimensions(std::size_t i, std::size_t j) override
+  {
+    destroy();
+    exists = true;
+    w = i;
+    h = j;
+
+    // +2 buffers so that set and unset won't need conditionals.
+    // They come zeroed, and untouched pages don't take any memory.
+    bda = Pages::allocate((i + 2) * (j + 2));
+    bda2 = Pages::allocate((i + 2) * (j + 2));
+    if (!bda || !bda2)
+    {
+      Pages::release(bda, (i + 2) * (j + 2));
+      Pages::release(bda2, (i + 2) * (j + 2));
+      bda = bda2 = nullptr;
+      exists = false;
+      throw std::bad_alloc();
+    }
+
+    layoutTiles();
+    clear();
+  }
+
+  void setDimensions(std::size_t i)
+  {
+    setDimensions(i, i);
+  }
+
+  std::size_t getWidth() const override
+  {
+    return w;
+  }
+
+  std::size_t getHeight() const override
+  {
+    return h;
+  }
+
+  // A file the grid was kept in stays behind with the last generation in it
+  void destroy() override
+  {
+    if (!exists) return;
+
+    if (header)
+    {
+      Pages::unmapFile(reinterpret_cast<unsigned char*>(header), fileBytes(w, h));
+      header = nullptr;
+    }
+    else
+    {
+      // Straight back to the OS, so a smaller grid after a big one really is smaller
+      Pages::release(bda, (w + 2) * (h + 2));
+      Pages::release(bda2, (w + 2) * (h + 2));
+    }
+    exists = false;
+  }
+
+  void clear() override
+  {
+    if (!exists) return;
+
+    if (header)
+    {
+      Pages::zeroFile(bda, bufferBytes(w, h));
+      Pages::zeroFile(bda2, bufferBytes(w, h));
+    }
+    else
+    {
+      Pages::zero(bda, (w + 2) * (h + 2));
+      Pages::zero(bda2, (w + 2) * (h + 2));
+    }
+    markAllChanged();
+    // Nothing can be born among dead cells since B0 isn't allowed
+    changes.clear();
+    allPending = false;
+    std::fill(counts.begin(), counts.end(), TileCount{});
+    live = born = died = 0;
+    std::fill(tileFlips.begin(), tileFlips.end(), 0);
+    gridHash = 0;
+    generations = 0;
+    forgetHistory();
+  }
+
+  bool exist() const override
+  {
+    return exists;
+  }
+
+  void forEachLive(const std::function<void(std::int64_t, std::int64_t)>& f) const override
+  {
+    for (std::size_t j = 0; j < h; j++)
+      for (std::size_t i = 0; i < w; i++)
+        if (bda[i + 1 + (j + 1) * (w + 2)] & 0x01) f(i, j);
+  }
+
+  Bitmap exportBitmap(std::int64_t left, std::int64_t top, std::size_t width, std::size_t height) const override
+  {
+    Bitmap bitmap(left, top, width, height);
+    if (!exists) return bitmap;
+
+    const std::int64_t x0 = std::max<std::int64_t>(left, 0), y0 = std::max<std::int64_t>(top, 0);
+    const std::int64_t x1 = std::min<std::int64_t>(left + width, w), y1 = std::min<std::int64_t>(top + height, h);
+    for (std::int64_t j = y0; j < y1; j++)
+      for (std::int64_t i = x0; i < x1; i++)
+        if (bda[i + 1 + (j + 1) * (w + 2)] & 0x01) bitmap.set(i, j);
+    return bitmap;
+  }
+
+  // Blocks of whole tiles are added up from the counts kept for every tile, so it costs
+  // as much as there are tiles. Smaller blocks are counted from the cells, a row of
+  // blocks per job on the threads that step the grid.
+  Density exportDensity(std::int64_t left, std::int64_t top, std::size_t width, std::size_t height, int level) const override
+  {
+    Density density(left, top, width, height, level);
+    if (!exists) return density;
+
+    const std::size_t size = std::size_t{ 1 } << level;
+    if (size % tileSize == 0)
+    {
+      for (std::size_t ty = 0; ty < tilesY; ty++)
+        for (std::size_t tx = 0; tx < tilesX; tx++)
+          density.add(static_cast<std::int64_t>(tx * tileSize / size), static_cast<std::int64_t>(ty * tileSize / size),
+            counts[ty * tilesX + tx].population);
+      return density;
+    }
+
+    const std::int64_t blocksX = static_cast<std::int64_t>((w + size - 1) / size);
+    const std::int64_t blocksY = static_cast<std::int64_t>((h + size - 1) / size);
+    const std::int64_t x0 = std::max<std::int64_t>(left, 0), x1 = std::min<std::int64_t>(left + width, blocksX);
+    const std::int64_t y0 = std::max<std::int64_t>(top, 0), y1 = std::min<std::int64_t>(top + height, blocksY);
+    if (x0 >= x1 || y0 >= y1) return density;
+
+    const auto countRow = [&](std::int64_t by) {
+      const std::size_t firstCol = static_cast<std::size_t>(x0) * size;
+      const std::size_t lastCol = std::min(static_cast<std::size_t>(x1) * size, w);
+      const std::size_t lastRow = std::min(static_cast<std::size_t>(by + 1) * size, h);
+      std::uint32_t* const out = density.counts.data() + static_cast<std::size_t>(by - top) * width + static_cast<std::size_t>(x0 - left);
+      for (std::size_t j = static_cast<std::size_t>(by) * size; j < lastRow; j++)
+      {
+        const unsigned char* const row = bda + 1 + (j + 1) * (w + 2);
+        if (size < 8)
+        {
+          for (std::size_t c = firstCol; c < lastCol; c++) out[(c - firstCol) / size] += row[c] & 0x01;
+          continue;
+        }
+        // Eight cells at a time, adding up their alive bits with a multiply
+        for (std::size_t c = firstCol; c < lastCol; c += 8)
+        {
+          std::uint64_t bytes{ 0 };
+          std::memcpy(&bytes, row + c, std::min<std::size_t>(8, lastCol - c));
+          out[(c - firstCol) / size] += static_cast<std::uint32_t>((bytes & 0x0101010101010101) * 0x0101010101010101 >> 56);
+        }
+      }
+    };
+
+    const std::size_t rows = static_cast<std::size_t>(y1 - y0);
+    if (!pool) for (std::size_t r = 0; r < rows; r++) countRow(y0 + static_cast<std::int64_t>(r));
+    else
+    {
+      const std::size_t jobs = std::min(pool->size() * 4, rows);
+      pool->run(jobs, [&](std::size_t job) {
+        for (std::size_t r = rows * job / jobs; r < rows * (job + 1) / jobs; r++) countRow(y0 + static_cast<std::int64_t>(r));
+      });
+    }
+    return density;
+  }
+
+  // Places every cell first and counts the neighbours of the whole grid
+  // once after, instead of informing the neighbours of each cell
+  void importBitmap(const Bitmap& bitmap) override
+  {
+    clear();
+    if (!exists) return;
+
+    for (std::size_t j = 0; j < h; j++)
+      for (std::size_t i = 0; i < w; i += 64)
+        forEachBit(bitmap.read(i, j), [&](int b) {
+          if (i + b >= w) return;
+          bda[i + b + 1 + (j + 1) * (w + 2)] = 0x01;
+          counts[j / tileSize * tilesX + (i + b) / tileSize].population++;
+        });
+    sumCounts();
+
+    const std::size_t stride = w + 2;
+    for (std::size_t j = 1; j <= h; j++)
+      for (std::size_t i = 1; i <= w; i++)
+      {
+        unsigned char* const c = bda + i + j * stride;
+        const unsigned int neighbours = (*(c - stride - 1) & 0x01) + (*(c - stride) & 0x01) + (*(c - stride + 1) & 0x01)
+          + (*(c - 1) & 0x01) + (*(c + 1) & 0x01)
+          + (*(c + stride - 1) & 0x01) + (*(c + stride) & 0x01) + (*(c + stride + 1) & 0x01);
+        *c = static_cast<unsigned char>(*c | neighbours << 1);
+      }
+
+    // bda2 isn't the generation before this one
+    markAllEdited();
+    borderDirty = torus;
+    if (hashing) rehash();
+  }
+
+private:
+  // One generation on, whichever way is set up
+  void advance()
+  {
+    fixBorder();
+
+    if (eventDriven)
+    {
+      nextGenEvents();
+      return;
+    }
+
+    // The scalar loop below is the fallback for CPUs without SIMD.
+    // It writes to the neighbours of every cell so it can't be split between threads,
+    // and it only knows Conway's rule on a grid with dead edges.
+    // It also needs bda2 to be right, which a file left by a crash may not be,
+    // and doesn't see which cells flip for the hash.
+    if (kernel != CellKernels::Type::scalar || getThreadCount() > 1 || rule != Rules::conway || torus || header || hashing)
+    {
+      nextGenGathered();
+      return;
+    }
+
     auto current = bda + 1 + w + 2; // skip buffer
     auto next = bda2 + 1 + w + 2; // skip buffer
 
@@ -84,7 +624,9 @@ struct Cells
     //auto end = bda + (w + 2) * (h + 2) - 1 - w - 2;
     unsigned char const* const end = bda + w * h + w + 2 * h + 1;
 
-    std::size_t x{ 0 };
+    for (auto& count : counts) count.births = count.deaths = 0;
+
+    std::size_t x{ 0 }, y{ 0 };
     do {
       // Count living neighbours
       switch (*current >> 1)
@@ -102,15 +644,18 @@ struct Cells
         }
         break;
       case 3:
+        if (!(*current & 0x01)) counts[y / tileSize * tilesX + x / tileSize].births++;
         setCell(next);
         break;
       default:
+        if (*current & 0x01) counts[y / tileSize * tilesX + x / tileSize].deaths++;
         unsetCell(next);
       }
 
       if (++x >= w)
       {
         x = 0;
+        y++;
         current += 2;
         next += 2;
       }
@@ -119,62 +664,754 @@ struct Cells
     } while (++current < end);
 
     // Swap arrays because bda2 now contains next gen
+    swapBuffers();
+
+    for (auto& count : counts) count.population += count.births - count.deaths;
+    sumCounts();
+
+    // Didn't keep track of what changed
+    markAllChanged();
+  }
+
+  // Computes every cell of bda2 from its neighbours in bda with a SIMD kernel,
+  // or one cell at a time without touching the neighbours if there is no SIMD.
+  // Every cell only writes its own byte so tiles can be given
+  // to different threads without any locking.
+  //
+  // Only tiles that changed since two generations ago, or have a neighbouring
+  // tile that did, are computed. The rest are left alone in bda2: a cell's byte
+  // depends on the cells up to two away, which are all in the tiles around it,
+  // so if those are the same as two generations ago then so is the cell's next
+  // byte, and that is what bda2 already holds. This way still lifes and
+  // blinkers, which is most of what a soup leaves behind, are skipped too.
+  void nextGenGathered()
+  {
+    // The kernels read the buffer cells as neighbours so they must be dead,
+    // or the cells from the other side on a torus
+    if (torus) wrapBuffer(bda);
+    else clearBuffer(bda);
+
+    if (!pool) pool = std::make_unique<ThreadPool>(threads);
+
+    // On a torus the tiles along an edge neighbour the ones on the other side
+    activeTiles.clear();
+    for (std::size_t ty = 0; ty < tilesY; ty++)
+      for (std::size_t tx = 0; tx < tilesX; tx++)
+      {
+        bool active{ false };
+        for (std::size_t dy = 0; dy < 3; dy++)
+          for (std::size_t dx = 0; dx < 3; dx++)
+          {
+            std::size_t y = ty + dy, x = tx + dx; // one more than the neighbour's
+            if (y == 0 || y > tilesY || x == 0 || x > tilesX)
+            {
+              if (!torus) continue;
+              y = (y + tilesY - 1) % tilesY + 1;
+              x = (x + tilesX - 1) % tilesX + 1;
+            }
+            active |= changed[(y - 1) * tilesX + x - 1] != 0;
+          }
+
+        if (active) activeTiles.push_back(ty * tilesX + tx);
+        else repeatCounts(ty * tilesX + tx);
+      }
+
+    std::fill(changedNext.begin(), changedNext.end(), 0);
+
+    const auto step = CellKernels::span(kernel, rule.transitions());
+    const std::uint32_t transitions = rule.transitions();
+    const auto run = [&](std::size_t begin, std::size_t end) {
+      // A few jobs per thread so a slow thread doesn't hold up the rest
+      std::size_t jobs = pool->size() * 4;
+      if (jobs > end - begin) jobs = end - begin;
+
+      pool->run(jobs, [&](std::size_t job) {
+        const std::size_t first = begin + (end - begin) * job / jobs;
+        const std::size_t last = begin + (end - begin) * (job + 1) / jobs;
+        for (std::size_t k = first; k < last; k++)
+        {
+          const std::size_t tile = activeTiles[k];
+          const std::size_t x0 = tile % tilesX * tileSize, y0 = tile / tilesX * tileSize;
+          const std::size_t tw = w - x0 < tileSize ? w - x0 : tileSize;
+          const std::size_t th = h - y0 < tileSize ? h - y0 : tileSize;
+
+          bool tileChanged{ false };
+          CellKernels::Tally tally;
+          std::uint64_t keys{ 0 };
+          for (std::size_t y = y0 + 1; y <= y0 + th; y++)
+          {
+            const std::size_t row = 1 + x0 + y * (w + 2);
+            const std::size_t flipped = tally.births + tally.deaths;
+            tileChanged |= step(bda + row, bda2 + row, w + 2, tw, transitions, tally);
+            // Most rows have no births or deaths and don't need looking at
+            if (hashing && tally.births + tally.deaths != flipped) keys ^= flippedKeys(row, tw);
+          }
+          // bda2 holds the edited generation after this one so it can't be trusted yet,
+          // or one from before a block of them
+          changedNext[tile] = tileChanged || changed[tile] >= edited;
+          setCounts(tile, tally);
+          tileFlips[tile] = keys;
+        }
+      });
+    };
+
+    if (!header) run(0, activeTiles.size());
+    else
+    {
+      // A file is gone through one strip of tiles at a time, from the top
+      for (std::size_t first = 0; first < activeTiles.size();)
+      {
+        const std::size_t strip = activeTiles[first] / tilesX;
+        std::size_t last = first;
+        while (last < activeTiles.size() && activeTiles[last] / tilesX == strip) last++;
+
+        streamStrip(strip);
+        run(first, last);
+        first = last;
+      }
+    }
+
+    swapBuffers();
+    sumCounts();
+    // Skipped tiles flip the same cells as last generation
+    if (hashing)
+      for (const auto keys : tileFlips) gridHash ^= keys;
+
+    changed.swap(changedNext);
+  }
+
+  void markAllChanged()
+  {
+    std::fill(changed.begin(), changed.end(), 1);
+    std::fill(touched.begin(), touched.end(), 1);
+  }
+
+  void markAllEdited()
+  {
+    std::fill(changed.begin(), changed.end(), edited);
+    std::fill(touched.begin(), touched.end(), 1);
+    allPending = true;
+  }
+
+  // A tile any cell of which was born or died last generation is different from the one before
+  void touchFlipped()
+  {
+    for (std::size_t t = 0; t < counts.size(); t++)
+      if (counts[t].births || counts[t].deaths) touched[t] = 1;
+  }
+
+  // Each job only writes the counts of its own tiles, which are added up after
+  void setCounts(std::size_t tile, const CellKernels::Tally& tally)
+  {
+    TileCount& count = counts[tile];
+    count.births = static_cast<std::uint32_t>(tally.births);
+    count.deaths = static_cast<std::uint32_t>(tally.deaths);
+    count.population += count.births - count.deaths;
+  }
+
+  // A skipped tile goes back to the generation before, so the cells that were born
+  // last time die and the ones that died are born again
+  void repeatCounts(std::size_t tile)
+  {
+    TileCount& count = counts[tile];
+    std::swap(count.births, count.deaths);
+    count.population += count.births - count.deaths;
+  }
+
+  // The keys of the n cells from p that are alive in bda but not bda2 or the other way round.
+  // Eight cells at a time, going straight to the ones that flipped.
+  std::uint64_t flippedKeys(std::size_t p, std::size_t n) const
+  {
+    std::uint64_t keys{ 0 };
+    for (std::size_t x = p; x < p + n; x += 8)
+    {
+      const std::size_t bytes = std::min<std::size_t>(8, p + n - x);
+      std::uint64_t a{ 0 }, b{ 0 };
+      std::memcpy(&a, bda + x, bytes);
+      std::memcpy(&b, bda2 + x, bytes);
+      forEachBit((a ^ b) & 0x0101010101010101, [&](int bit) {
+        keys ^= key(x + (littleEndian() ? bit / 8 : 7 - bit / 8));
+      });
+    }
+    return keys;
+  }
+
+  // Whether the first byte in memory of a word is its lowest
+  static bool littleEndian()
+  {
+    const std::uint16_t one{ 1 };
+    unsigned char first;
+    std::memcpy(&first, &one, 1);
+    return first == 1;
+  }
+
+  // Hashes a grid that wasn't built up here cell by cell
+  void rehash()
+  {
+    gridHash = 0;
+    for (std::size_t j = 1; j <= h; j++)
+      for (std::size_t i = 1; i <= w; i++)
+        if (bda[i + j * (w + 2)] & 0x01) gridHash ^= key(i + j * (w + 2));
+  }
+
+  // Looks for the grid among the last generations' and adds it to them
+  void remember()
+  {
+    cyclePeriod = 0;
+    for (const auto& seen : history)
+      if (seen.hash == gridHash && (!cyclePeriod || generations - seen.generation < cyclePeriod))
+        cyclePeriod = generations - seen.generation;
+
+    if (history.size() < historyLength) history.push_back({ generations, gridHash });
+    else history[oldest] = { generations, gridHash };
+    oldest = (oldest + 1) % historyLength;
+  }
+
+  // After an edit, or the rule or edges change, the same grid doesn't go the same way any more
+  void forgetHistory()
+  {
+    history.clear();
+    oldest = 0;
+    cyclePeriod = 0;
+  }
+
+  // The key of the cell at p in bda, the finishing mix of splitmix64
+  static std::uint64_t key(std::size_t p)
+  {
+    std::uint64_t z = static_cast<std::uint64_t>(p) * 0x9E3779B97F4A7C15;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+    return z ^ (z >> 31);
+  }
+
+  void sumCounts()
+  {
+    live = born = died = 0;
+    for (const auto& count : counts)
+    {
+      live += count.population;
+      born += count.births;
+      died += count.deaths;
+    }
+  }
+
+  // Counts the cells of a grid that wasn't built up here, like one from a file
+  void countCells()
+  {
+    std::fill(counts.begin(), counts.end(), TileCount{});
+    for (std::size_t j = 0; j < h; j++)
+      for (std::size_t i = 0; i < w; i++)
+        counts[j / tileSize * tilesX + i / tileSize].population += bda[i + 1 + (j + 1) * (w + 2)] & 0x01;
+    sumCounts();
+  }
+
+  void fixBorder()
+  {
+    if (!borderDirty) return;
+
+    // The scalar loop adds to the counts already in bda2 so those must be right too
+    recountBorder(bda);
+    recountBorder(bda2);
+    borderDirty = false;
+  }
+
+  // Temporal blocking: every block of the grid is copied, with depth cells around it,
+  // into scratch memory small enough to stay in cache and run depth generations there,
+  // then only its middle is written to bda2. Each generation the part of the copy
+  // that's still right shrinks by a cell on every side, so after depth of them it's
+  // just the middle. The grid goes through memory once for all of them instead of
+  // twice a generation, for the cost of working out the cells around each block again.
+  //
+  // A block is skipped if every tile within depth cells of it is the same as two
+  // generations ago, since it will keep flipping between the last two generations.
+  // After an odd number that's the one in bda2, if bda2 holds the generation before,
+  // and a skipped block costs nothing. After an even number it's copied over from bda,
+  // and then its tiles that flip are stale: bda2 isn't the generation before any more.
+  // A block that's run leaves the generation it started from in bda, which is only
+  // the one before its last if the block has settled, so otherwise its tiles are stale
+  // too, or edited if they aren't the same as two generations ago either.
+  // Only odd numbers run after one another, so idle blocks stay free for long steps.
+  void nextGensBlocked(std::size_t depth)
+  {
+    fixBorder();
+    if (!pool) pool = std::make_unique<ThreadPool>(threads);
+
+    const std::size_t blocksX = (w + blockSize - 1) / blockSize;
+    const std::size_t blocks = blocksX * ((h + blockSize - 1) / blockSize);
+    const std::size_t reach = (depth + tileSize - 1) / tileSize;
+    // Stale tiles are the same as two generations ago, which is all an even number needs
+    const unsigned char idle = depth % 2 ? 0 : stale;
+
+    std::fill(changedNext.begin(), changedNext.end(), 0);
+
+    std::size_t jobs = pool->size() * 4;
+    if (jobs > blocks) jobs = blocks;
+
+    // Only the last generation of a block counts its births and deaths
+    const auto step = CellKernels::span(kernel, rule.transitions(), false);
+    const auto last = CellKernels::span(kernel, rule.transitions());
+    const std::uint32_t transitions = rule.transitions();
+    pool->run(jobs, [&](std::size_t job) {
+      std::vector<unsigned char> a(scratchStride * scratchStride), b(scratchStride * scratchStride), c(blockSize * blockSize);
+      for (std::size_t k = blocks * job / jobs; k < blocks * (job + 1) / jobs; k++)
+      {
+        const std::size_t bx = k % blocksX, by = k / blocksX;
+        if (!blockIdle(bx, by, reach, idle))
+        {
+          runBlock(bx, by, depth, step, last, transitions, a.data(), b.data(), c.data());
+          continue;
+        }
+
+        const std::size_t x0 = bx * blockSize, y0 = by * blockSize;
+        const std::size_t bw = std::min(blockSize, w - x0), bh = std::min(blockSize, h - y0);
+        if (depth % 2 == 0)
+        {
+          for (std::size_t y = y0 + 1; y <= y0 + bh; y++)
+            std::memcpy(bda2 + 1 + x0 + y * (w + 2), bda + 1 + x0 + y * (w + 2), bw);
+          for (std::size_t ty = y0 / tileSize; ty * tileSize < y0 + bh; ty++)
+            for (std::size_t tx = x0 / tileSize; tx * tileSize < x0 + bw; tx++)
+            {
+              const TileCount& count = counts[ty * tilesX + tx];
+              if (count.births || count.deaths) changedNext[ty * tilesX + tx] = stale;
+            }
+        }
+        else
+        {
+          // Left as the generation before, the last generation flipped the cells back
+          for (std::size_t ty = y0 / tileSize; ty * tileSize < y0 + bh; ty++)
+            for (std::size_t tx = x0 / tileSize; tx * tileSize < x0 + bw; tx++) repeatCounts(ty * tilesX + tx);
+        }
+      }
+    });
+
+    swapBuffers();
+    sumCounts();
+    touchFlipped();
+    generations += depth;
+    changed.swap(changedNext);
+  }
+
+  std::size_t changedTiles() const
+  {
+    std::size_t n{ 0 };
+    for (const auto c : changed) n += c != 0;
+    return n;
+  }
+
+  // Whether every tile within reach tiles of a block is marked idle or 0
+  bool blockIdle(std::size_t bx, std::size_t by, std::size_t reach, unsigned char idle) const
+  {
+    const std::int64_t perBlock = blockSize / tileSize, r = static_cast<std::int64_t>(reach);
+    const std::int64_t tw = static_cast<std::int64_t>(tilesX), th = static_cast<std::int64_t>(tilesY);
+    for (std::int64_t y = static_cast<std::int64_t>(by) * perBlock - r; y < (static_cast<std::int64_t>(by) + 1) * perBlock + r; y++)
+      for (std::int64_t x = static_cast<std::int64_t>(bx) * perBlock - r; x < (static_cast<std::int64_t>(bx) + 1) * perBlock + r; x++)
+      {
+        std::int64_t tx = x, ty = y;
+        if (tx < 0 || ty < 0 || tx >= tw || ty >= th)
+        {
+          if (!torus) continue;
+          tx = (tx % tw + tw) % tw;
+          ty = (ty % th + th) % th;
+        }
+        if (changed[ty * tw + tx] && changed[ty * tw + tx] != idle) return false;
+      }
+    return true;
+  }
+
+  // Runs one block depth generations on in the scratch buffers a and b and writes it to bda2.
+  // Scratch cell x, y is grid cell x0 - depth + x, y0 - depth + y.
+  // The block as it started is kept in c, blockSize cells a row, to compare the end with.
+  // The last generation is run with last, which counts the births and deaths.
+  void runBlock(std::size_t bx, std::size_t by, std::size_t depth,
+    CellKernels::Span step, CellKernels::Span last, std::uint32_t transitions, unsigned char* const a, unsigned char* const b, unsigned char* const c)
+  {
+    const std::size_t x0 = bx * blockSize, y0 = by * blockSize;
+    const std::size_t bw = std::min(blockSize, w - x0), bh = std::min(blockSize, h - y0);
+    const std::size_t sw = bw + 2 * depth, sh = bh + 2 * depth;
+    const std::int64_t gw = static_cast<std::int64_t>(w), gh = static_cast<std::int64_t>(h);
+
+    // Past dead edges the copy is dead, on a torus it comes from the other side
+    for (std::size_t sy = 0; sy < sh; sy++)
+    {
+      unsigned char* const row = a + sy * scratchStride;
+      std::int64_t gy = static_cast<std::int64_t>(y0 + sy) - static_cast<std::int64_t>(depth);
+      if (gy < 0 || gy >= gh)
+      {
+        if (!torus)
+        {
+          std::memset(row, 0, sw);
+          continue;
+        }
+        gy = (gy % gh + gh) % gh;
+      }
+
+      const unsigned char* const from = bda + 1 + (gy + 1) * (w + 2);
+      std::int64_t gx = static_cast<std::int64_t>(x0) - static_cast<std::int64_t>(depth);
+      for (std::size_t sx = 0; sx < sw;)
+      {
+        std::size_t n;
+        if (!torus && (gx < 0 || gx >= gw))
+        {
+          n = gx < 0 ? std::min<std::size_t>(static_cast<std::size_t>(-gx), sw - sx) : sw - sx;
+          std::memset(row + sx, 0, n);
+        }
+        else
+        {
+          const std::int64_t x = (gx % gw + gw) % gw;
+          n = std::min<std::size_t>(static_cast<std::size_t>(gw - x), sw - sx);
+          std::memcpy(row + sx, from + x, n);
+        }
+        sx += n;
+        gx += static_cast<std::int64_t>(n);
+      }
+    }
+    // b starts as this generation too, it's what the last one is compared against when depth is 2
+    std::memcpy(b, a, sh * scratchStride);
+    for (std::size_t y = 0; y < bh; y++) std::memcpy(c + y * blockSize, a + depth + (depth + y) * scratchStride, bw);
+
+    // The cells each generation can work out, kept inside the grid if the edges are dead
+    // since the cells past them have to stay dead
+    const std::size_t minX = !torus && x0 < depth ? depth - x0 : 0, minY = !torus && y0 < depth ? depth - y0 : 0;
+    const std::size_t maxX = !torus ? std::min(sw, depth + w - x0) : sw, maxY = !torus ? std::min(sh, depth + h - y0) : sh;
+
+    bool tileChanged[blockSize / tileSize][blockSize / tileSize]{};
+    CellKernels::Tally tally[blockSize / tileSize][blockSize / tileSize]{};
+    CellKernels::Tally ignored;
+    for (std::size_t g = 1; g <= depth; g++)
+    {
+      const unsigned char* const from = g % 2 ? a : b;
+      unsigned char* const to = g % 2 ? b : a;
+      const std::size_t left = std::max(g, minX), right = std::min(sw - g, maxX);
+      const std::size_t top = std::max(g, minY), bottom = std::min(sh - g, maxY);
+
+      for (std::size_t sy = top; sy < bottom; sy++)
+      {
+        const std::size_t offset = left + sy * scratchStride;
+        if (g < depth)
+        {
+          step(from + offset, to + offset, scratchStride, right - left, transitions, ignored);
+          continue;
+        }
+
+        // The last generation is just the block, checked tile by tile against two generations ago
+        for (std::size_t tx = 0; tx * tileSize < bw; tx++)
+          tileChanged[(sy - depth) / tileSize][tx] |= last(from + offset + tx * tileSize, to + offset + tx * tileSize,
+            scratchStride, std::min(tileSize, bw - tx * tileSize), transitions, tally[(sy - depth) / tileSize][tx]);
+      }
+    }
+
+    // Only the last generation's births and deaths are known, so the tiles' cells are counted as they're written.
+    // Each tile's generation before the last is compared with the one it started from.
+    const unsigned char* const result = depth % 2 ? b : a;
+    const unsigned char* const before = depth % 2 ? a : b;
+    std::uint32_t population[blockSize / tileSize][blockSize / tileSize]{};
+    bool settled[blockSize / tileSize][blockSize / tileSize]{};
+    for (std::size_t ty = 0; ty * tileSize < bh; ty++)
+      for (std::size_t tx = 0; tx * tileSize < bw; tx++) settled[ty][tx] = true;
+    for (std::size_t y = 0; y < bh; y++)
+    {
+      const unsigned char* const row = result + depth + (depth + y) * scratchStride;
+      const unsigned char* const rowBefore = before + depth + (depth + y) * scratchStride;
+      const unsigned char* const start = c + y * blockSize;
+      std::memcpy(bda2 + 1 + x0 + (y0 + y + 1) * (w + 2), row, bw);
+      for (std::size_t tx = 0; tx * tileSize < bw; tx++)
+      {
+        const std::size_t first = tx * tileSize, n = std::min(bw - first, tileSize);
+        std::uint32_t alive{ 0 };
+        for (std::size_t x = first; x < first + n; x++) alive += row[x] & 0x01;
+        population[y / tileSize][tx] += alive;
+        // Once a tile is known to differ the rest of it isn't looked at
+        bool& same = settled[y / tileSize][tx];
+        if (same) same = std::memcmp(rowBefore + first, start + first, n) == 0;
+      }
+    }
+
+    for (std::size_t ty = 0; ty * tileSize < bh; ty++)
+      for (std::size_t tx = 0; tx * tileSize < bw; tx++)
+      {
+        const std::size_t tile = (y0 / tileSize + ty) * tilesX + x0 / tileSize + tx;
+        if (settled[ty][tx]) changedNext[tile] = tileChanged[ty][tx];
+        else changedNext[tile] = tileChanged[ty][tx] ? edited : stale;
+        // Only the last generation is counted, and the ones before could have changed it too
+        touched[tile] = 1;
+        counts[tile] = { population[ty][tx], static_cast<std::uint32_t>(tally[ty][tx].births),
+          static_cast<std::uint32_t>(tally[ty][tx].deaths) };
+      }
+  }
+
+  void layoutTiles()
+  {
+    tilesX = (w + tileSize - 1) / tileSize;
+    tilesY = (h + tileSize - 1) / tileSize;
+    changed.assign(tilesX * tilesY, 1);
+    changedNext.assign(tilesX * tilesY, 0);
+    activeTiles.reserve(tilesX * tilesY);
+    counts.assign(tilesX * tilesY, TileCount{});
+    tileFlips.assign(tilesX * tilesY, 0);
+    touched.assign(tilesX * tilesY, 1);
+  }
+
+  // The file remembers which buffer is the current generation
+  void swapBuffers()
+  {
     auto temp = bda;
     bda = bda2;
     bda2 = temp;
+
+    if (header)
+    {
+      header->flipped ^= 1;
+      header->generation++;
+    }
   }
 
-  void setDimensions(std::size_t i, std::size_t j)
+  // A file is the header followed by the two buffers, each starting on a page
+  static std::size_t bufferBytes(std::size_t i, std::size_t j)
+  {
+    return ((i + 2) * (j + 2) + headerBytes - 1) / headerBytes * headerBytes;
+  }
+
+  static std::size_t fileBytes(std::size_t i, std::size_t j)
+  {
+    return headerBytes + 2 * bufferBytes(i, j);
+  }
+
+  void useFile(unsigned char* const mapped, std::size_t i, std::size_t j)
   {
-    destroy();
     exists = true;
     w = i;
     h = j;
+    header = reinterpret_cast<FileHeader*>(mapped);
 
-    // +2 buffers so that set and unset won't need conditionals
-    bda = new unsigned char[(i + 2) * (j + 2)];
-    bda2 = new unsigned char[(i + 2) * (j + 2)];
-    clear();
+    unsigned char* const first = mapped + headerBytes;
+    unsigned char* const second = first + bufferBytes(i, j);
+    bda = header->flipped ? second : first;
+    bda2 = header->flipped ? first : second;
+
+    layoutTiles();
   }
 
-  void setDimensions(std::size_t i)
+  // Before a strip of tiles of a file is stepped, asks for the one after it to be read
+  // and lets the OS write out and drop the one before, which nothing reads any more
+  void streamStrip(std::size_t strip)
   {
-    setDimensions(i, i);
+    const std::size_t stride = w + 2;
+    const std::size_t rows = tileSize * stride;
+
+    // The buffer rows the next strip reads are one above and below its own
+    const std::size_t next = (strip + 1) * tileSize;
+    if (next < h)
+    {
+      const std::size_t count = std::min(tileSize + 2, h + 2 - next) * stride;
+      Pages::willNeed(bda + next * stride, count);
+      Pages::willNeed(bda2 + next * stride, count);
+    }
+
+    if (strip > 0)
+    {
+      Pages::done(bda + (strip - 1) * rows, rows);
+      Pages::done(bda2 + (strip - 1) * rows, rows);
+    }
   }
 
-  std::size_t getWidth()
+  // Looks only at the cells that changed last generation, or were edited since,
+  // and their neighbours. The ones that flip are collected before any is applied,
+  // so every cell is judged on the counts of this generation,
+  // then each flip tells its neighbours the way setCell and unsetCell do.
+  void nextGenEvents()
   {
-    return w;
+    const std::uint32_t transitions = rule.transitions();
+    const auto consider = [&](std::size_t p) {
+      const unsigned char c = bda[p];
+      if ((transitions >> (c & 0x1F) & 1) != (c & 0x01u)) flips.push_back(p);
+    };
+
+    flips.clear();
+    if (allPending)
+    {
+      for (std::size_t y = 1; y <= h; y++)
+        for (std::size_t x = 1; x <= w; x++) consider(x + y * (w + 2));
+      allPending = false;
+    }
+    else
+    {
+      // A cell can be next to several changes, the queued bit makes sure it's looked at once
+      candidates.clear();
+      for (const auto p : changes)
+        forEachAround(p, [&](std::size_t q) {
+          if (bda[q] & queued) return;
+          bda[q] |= queued;
+          candidates.push_back(q);
+        });
+
+      for (const auto p : candidates)
+      {
+        bda[p] &= ~queued;
+        consider(p);
+      }
+    }
+
+    born = died = 0;
+    for (const auto p : flips)
+    {
+      const bool birth = !(bda[p] & 0x01);
+      if (birth) setCell(bda + p);
+      else unsetCell(bda + p);
+      if (hashing) gridHash ^= key(p);
+
+      // Tiles' births and deaths aren't kept up here, every tile is stepped again after events
+      const std::size_t tile = (p / (w + 2) - 1) / tileSize * tilesX + (p % (w + 2) - 1) / tileSize;
+      TileCount& count = counts[tile];
+      touched[tile] = 1;
+      if (birth)
+      {
+        count.population++;
+        born++;
+      }
+      else
+      {
+        count.population--;
+        died++;
+      }
+
+      // setCell and unsetCell only reach the buffer cells past the edge
+      if (torus) forEachAcross(p, [&](std::size_t q) {
+        bda[q] = static_cast<unsigned char>(birth ? bda[q] + 0x02 : bda[q] - 0x02);
+      });
+    }
+    live += born;
+    live -= died;
+
+    changes.swap(flips);
+    if (header) header->generation++;
   }
 
-  std::size_t getHeight()
+  // Calls f with the index in bda of the cell at p and of its neighbours in the grid,
+  // which on a torus includes the ones across the edge
+  template <typename F>
+  void forEachAround(std::size_t p, F f) const
   {
-    return h;
+    const std::size_t stride = w + 2;
+    const std::size_t x = p % stride, y = p / stride;
+
+    if (x > 1 && x < w && y > 1 && y < h)
+    {
+      for (const std::size_t row : { p - stride, p, p + stride })
+      {
+        f(row - 1);
+        f(row);
+        f(row + 1);
+      }
+      return;
+    }
+
+    for (std::size_t dy = 0; dy < 3; dy++)
+      for (std::size_t dx = 0; dx < 3; dx++)
+      {
+        std::size_t nx = x + dx - 1, ny = y + dy - 1;
+        if (ny == 0 || ny > h || nx == 0 || nx > w)
+        {
+          if (!torus) continue;
+          ny = (ny + h - 1) % h + 1;
+          nx = (nx + w - 1) % w + 1;
+        }
+        f(nx + ny * stride);
+      }
   }
 
-  void destroy()
+  // Calls f with the index in bda of every neighbour of the cell at p that is across
+  // the edge of a torus, once for each side it's a neighbour from, like recountBorder counts them
+  template <typename F>
+  void forEachAcross(std::size_t p, F f) const
   {
-    if (!exists) return;
+    const std::size_t stride = w + 2;
+    const std::size_t x = p % stride, y = p / stride;
+    if (x > 1 && x < w && y > 1 && y < h) return;
 
-    delete[] bda;
-    delete[] bda2;
-    exists = false;
+    for (std::size_t dy = 0; dy < 3; dy++)
+      for (std::size_t dx = 0; dx < 3; dx++)
+      {
+        std::size_t nx = x + dx - 1, ny = y + dy - 1;
+        if (ny != 0 && ny <= h && nx != 0 && nx <= w) continue;
+
+        ny = (ny + h - 1) % h + 1;
+        nx = (nx + w - 1) % w + 1;
+        f(nx + ny * stride);
+      }
   }
 
-  void clear()
+  // setCell and unsetCell count neighbours in the buffer cells too,
+  // so they can have any count but are never alive
+  void clearBuffer(unsigned char* const arr)
   {
-    if (!exists) return;
+    std::memset(arr, 0, w + 2);
+    std::memset(arr + (h + 1) * (w + 2), 0, w + 2);
+    for (std::size_t y = 1; y <= h; y++)
+    {
+      arr[y * (w + 2)] = 0;
+      arr[y * (w + 2) + w + 1] = 0;
+    }
+  }
 
-    std::memset(bda, 0, (w + 2) * (h + 2));
-    std::memset(bda2, 0, (w + 2) * (h + 2));
+  // Copies the cells along each edge into the buffer cells past the opposite edge,
+  // the columns first so the corners get the opposite corners from the rows
+  void wrapBuffer(unsigned char* const arr)
+  {
+    for (std::size_t y = 1; y <= h; y++)
+    {
+      arr[y * (w + 2)] = arr[y * (w + 2) + w];
+      arr[y * (w + 2) + w + 1] = arr[y * (w + 2) + 1];
+    }
+    std::memcpy(arr, arr + h * (w + 2), w + 2);
+    std::memcpy(arr + (h + 1) * (w + 2), arr + w + 2, w + 2);
   }
 
-  bool exist()
+  bool onBorder(std::int64_t i, std::int64_t j) const
   {
-    return exists;
+    return i == 0 || j == 0 || i + 1 == static_cast<std::int64_t>(w) || j + 1 == static_cast<std::int64_t>(h);
+  }
+
+  // setCell and unsetCell only inform the neighbours inside the buffer cells,
+  // so on a torus the cells along the edges miss their neighbours on the other side.
+  // Switching between a torus and dead edges changes their counts too.
+  void recountBorder(unsigned char* const arr)
+  {
+    if (!exists) return;
+
+    const auto count = [&](std::size_t i, std::size_t j) {
+      unsigned int neighbours{ 0 };
+      for (std::size_t dy = 0; dy < 3; dy++)
+        for (std::size_t dx = 0; dx < 3; dx++)
+        {
+          if (dy == 1 && dx == 1) continue;
+
+          // Both are one more than the neighbour's, so -1 is 0
+          std::size_t x = i + dx, y = j + dy;
+          if (y == 0 || y > h || x == 0 || x > w)
+          {
+            if (!torus) continue;
+            y = (y + h - 1) % h + 1;
+            x = (x + w - 1) % w + 1;
+          }
+          neighbours += arr[x + y * (w + 2)] & 0x01;
+        }
+
+      unsigned char* const cell = arr + i + 1 + (j + 1) * (w + 2);
+      *cell = static_cast<unsigned char>((*cell & 0x01) | neighbours << 1);
+    };
+
+    for (std::size_t i = 0; i < w; i++)
+    {
+      count(i, 0);
+      count(i, h - 1);
+    }
+    for (std::size_t j = 1; j + 1 < h; j++)
+    {
+      count(0, j);
+      count(w - 1, j);
+    }
   }
 
-private:
   // The big dumb arrays that store the data
   // first bit is if I'm alive or not
   // next four are my neighbours
@@ -184,6 +1421,90 @@ private:
   bool exists;
   std::size_t w;
   std::size_t h;
+  CellKernels::Type kernel;
+  std::size_t threads{ 0 };
+  std::unique_ptr<ThreadPool> pool;
+  bool torus{ false };
+  bool borderDirty{ false }; // the counts along the edges are wrong
+
+  // Blocks are this many cells square and run up to maxDepth generations at once,
+  // small enough for two scratch copies to stay in the L2 cache
+  static constexpr std::size_t blockSize{ 256 };
+  static constexpr std::size_t maxDepth{ 12 };
+  static constexpr std::size_t blockingBytes{ std::size_t{ 2 } << 20 }; // smallest grid step runs in blocks
+  static constexpr std::size_t scratchStride{ blockSize + 2 * maxDepth };
+
+  bool eventDriven{ false };
+  bool allPending{ true }; // every cell has to be looked at, the changes aren't known
+  // Marks a cell already in candidates, above the alive bit and the count
+  static constexpr unsigned char queued{ 0x20 };
+  std::vector<std::size_t> changes; // cells that changed last generation or were edited
+  std::vector<std::size_t> flips;
+  std::vector<std::size_t> candidates;
+
+  // What's at the start of a file backed grid, in the byte order of the machine
+  struct FileHeader
+  {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t flipped; // 1 if the second buffer holds the current generation
+    std::uint64_t width;
+    std::uint64_t height;
+    std::uint64_t generation;
+    std::uint16_t birth;
+    std::uint16_t survival;
+    std::uint8_t torus;
+  };
+  static constexpr char fileMagic[8]{ 'L', 'I', 'F', 'E', 'G', 'R', 'I', 'D' };
+  static constexpr std::uint32_t fileVersion{ 1 };
+  // Big enough to keep the buffers on page boundaries with any page size
+  static constexpr std::size_t headerBytes{ 65536 };
+  FileHeader* header{ nullptr };
+
+  // Side of the square tiles nextGen skips when nothing around them changes
+  static constexpr std::size_t tileSize{ 64 };
+  std::size_t tilesX{ 0 };
+  std::size_t tilesY{ 0 };
+  // 1 for the tiles that are different from two generations ago,
+  // edited for the ones setCell or unsetCell was called on since last generation,
+  // stale for the ones that are the same but aren't in bda2 as they were the generation before
+  static constexpr unsigned char edited{ 2 };
+  static constexpr unsigned char stale{ 3 };
+  std::vector<unsigned char> changed;
+  std::vector<unsigned char> changedNext;
+  std::vector<std::size_t> activeTiles;
+
+  // The live cells of every tile and how many were born and died in it last generation,
+  // kept per tile so the tiles nextGen skips can be worked out from their last ones
+  // and threads never add to the same count
+  struct TileCount
+  {
+    std::uint32_t population;
+    std::uint32_t births;
+    std::uint32_t deaths;
+  };
+  std::vector<TileCount> counts;
+  // 1 for the tiles that changed since takeChanges was last called
+  std::vector<unsigned char> touched;
+  std::uint64_t live{ 0 };
+  std::uint64_t born{ 0 };
+  std::uint64_t died{ 0 };
+  std::uint64_t generations{ 0 };
+
+  bool hashing{ false };
+  std::uint64_t gridHash{ 0 };
+  // The keys of the cells that flipped in each tile last generation
+  std::vector<std::uint64_t> tileFlips;
+  // The hashes of the last historyLength generations, written round and round
+  struct Seen
+  {
+    std::uint64_t generation;
+    std::uint64_t hash;
+  };
+  static constexpr std::size_t historyLength{ 256 };
+  std::vector<Seen> history;
+  std::size_t oldest{ 0 }; // the one the next generation replaces once it's full
+  std::uint64_t cyclePeriod{ 0 };
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,159 @@
+// Checks that the ways Cells can be run agree with each other, built and run with `make check`.
+// Several generations at once in blocks have to end where one generation at a time does,
+// and say which tiles changed, and every kernel and number of threads has to give the
+// same cells. Prints what didn't match and exits with 1 if anything didn't.
+
+#include "Cells.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+
+namespace
+{
+  int failures{ 0 };
+
+  void fail(const std::string& what)
+  {
+    std::fprintf(stderr, "FAIL %s\n", what.c_str());
+    failures++;
+  }
+
+  // A soup over the whole grid, with some empty squares in it so there are blocks with nothing to do
+  Bitmap soup(std::size_t width, std::size_t height, std::uint64_t seed)
+  {
+    Bitmap bitmap(0, 0, width, height);
+    std::mt19937_64 random(seed);
+    for (std::size_t j = 0; j < height; j++)
+      for (std::size_t i = 0; i < width; i++)
+      {
+        const bool hole = (i / 384) % 3 == 1 && (j / 384) % 3 == 1;
+        if (!hole && random() % 100 < 35) bitmap.set(static_cast<std::int64_t>(i), static_cast<std::int64_t>(j));
+      }
+    return bitmap;
+  }
+
+  Bitmap cellsOf(const Cells& cells)
+  {
+    return cells.exportBitmap(0, 0, cells.getWidth(), cells.getHeight());
+  }
+
+  std::string describe(const char* name, bool torus, std::size_t threads)
+  {
+    return std::string(name) + (torus ? " torus" : " dead edges") + ", " + std::to_string(threads) + " threads";
+  }
+
+  // step(k) against k calls to nextGen on a grid big enough to be run in blocks,
+  // for every k up to past the deepest batch and back down again
+  void checkBlocked(bool torus, std::size_t threads)
+  {
+    const std::size_t width{ 2560 }, height{ 1600 };
+    const Bitmap start = soup(width, height, 1);
+
+    Cells blocked(width, height), single(width, height);
+    for (Cells* cells : { &blocked, &single })
+    {
+      cells->setTorus(torus);
+      cells->setThreadCount(threads);
+      cells->importBitmap(start);
+    }
+
+    Bitmap tiles(0, 0, (width + 63) / 64, (height + 63) / 64);
+    blocked.takeChanges(tiles);
+
+    for (std::uint64_t round = 0; round < 28; round++)
+    {
+      const std::uint64_t k = round < 14 ? round + 1 : 28 - round;
+      const Bitmap before = cellsOf(blocked);
+
+      blocked.step(k);
+      for (std::uint64_t n = 0; n < k; n++) single.nextGen();
+
+      const Bitmap after = cellsOf(blocked);
+      const std::string what = describe("step", torus, threads) + ", step(" + std::to_string(k) + ")";
+      if (after.words != cellsOf(single).words)
+      {
+        fail(what + " differs from nextGen");
+        return;
+      }
+      if (blocked.generation() != single.generation() || blocked.population() != single.population())
+        fail(what + " counts generations or population differently");
+
+      // Every tile with a cell that's different has to be in the changes
+      Bitmap changes(0, 0, tiles.w, tiles.h);
+      blocked.takeChanges(changes);
+      // A word of a row is a row of a tile
+      for (std::size_t j = 0; j < height; j++)
+        for (std::size_t c = 0; c < after.stride; c++)
+        {
+          const std::size_t word = j * after.stride + c;
+          if (before.words[word] != after.words[word] && !changes.get(static_cast<std::int64_t>(c), static_cast<std::int64_t>(j / 64)))
+          {
+            fail(what + " left a changed tile out of takeChanges");
+            return;
+          }
+        }
+    }
+  }
+
+  // Every kernel the CPU has, and more than one thread, against the scalar one
+  void checkKernels(bool torus, const char* ruleText)
+  {
+    const std::size_t width{ 300 }, height{ 200 };
+    const Bitmap start = soup(width, height, 2);
+
+    Rule rule;
+    Rule::parse(ruleText, rule);
+
+    Cells reference(width, height);
+    reference.setKernel(CellKernels::Type::scalar);
+    reference.setThreadCount(1);
+
+    const CellKernels::Type types[]{ CellKernels::Type::sse2, CellKernels::Type::avx2, CellKernels::Type::avx512 };
+    const char* const names[]{ "sse2", "avx2", "avx512" };
+
+    for (std::size_t t = 0; t < 4; t++)
+    {
+      // The last one is the best kernel with three threads
+      const bool threaded = t == 3;
+      if (!threaded && types[t] > CellKernels::best()) continue;
+
+      Cells cells(width, height);
+      cells.setKernel(threaded ? CellKernels::best() : types[t]);
+      cells.setThreadCount(threaded ? 3 : 1);
+      for (Cells* c : { &reference, &cells })
+      {
+        c->setTorus(torus);
+        c->setRule(rule);
+        c->importBitmap(start);
+      }
+
+      const std::string what = describe(threaded ? "best kernel" : names[t], torus, threaded ? 3 : 1) + ", " + ruleText;
+      for (int gen = 0; gen < 100; gen++)
+      {
+        reference.nextGen();
+        cells.nextGen();
+        if (cellsOf(cells).words != cellsOf(reference).words)
+        {
+          fail(what + " differs from scalar at generation " + std::to_string(gen + 1));
+          break;
+        }
+      }
+    }
+  }
+}
+
+int main()
+{
+  for (const bool torus : { false, true })
+  {
+    for (const std::size_t threads : { 1, 3 }) checkBlocked(torus, threads);
+    for (const char* rule : { "B3/S23", "B36/S23" }) checkKernels(torus, rule);
+  }
+
+  if (failures) return 1;
+  std::printf("all checks passed\n");
+  return 0;
+}
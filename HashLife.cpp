@@ -0,0 +1,451 @@
+#include "HashLife.h"
+
+HashLife::HashLife()
+{
+  reset();
+}
+
+void HashLife::reset()
+{
+  nodes.clear();
+  table.clear();
+  empties.clear();
+
+  nodes.push_back({ nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0 });
+  dead = &nodes.back();
+  nodes.push_back({ nullptr, nullptr, nullptr, nullptr, nullptr, 1, 0 });
+  alive = &nodes.back();
+  empties.push_back(dead);
+
+  root = empty(3);
+  originX = 0;
+  originY = 0;
+  generation = 0;
+}
+
+HashLife::Node* HashLife::join(Node* nw, Node* ne, Node* sw, Node* se)
+{
+  const Children key{ nw, ne, sw, se };
+  const auto found = table.find(key);
+  if (found != table.end()) return found->second;
+
+  nodes.push_back({ nw, ne, sw, se, nullptr,
+    nw->population + ne->population + sw->population + se->population,
+    nw->level + 1 });
+  Node* const n = &nodes.back();
+  table.emplace(key, n);
+  return n;
+}
+
+HashLife::Node* HashLife::empty(int level)
+{
+  while (static_cast<int>(empties.size()) <= level)
+  {
+    Node* const e = empties.back();
+    empties.push_back(join(e, e, e, e));
+  }
+  return empties[level];
+}
+
+// The 2^(k-1) square in the middle of a 2^k node
+HashLife::Node* HashLife::centre(Node* n)
+{
+  return join(n->nw->se, n->ne->sw, n->sw->ne, n->se->nw);
+}
+
+HashLife::Node* HashLife::set(Node* n, std::int64_t x, std::int64_t y, Node* cell)
+{
+  if (n->level == 0) return cell;
+
+  const std::int64_t half = std::int64_t{ 1 } << (n->level - 1);
+  if (y < half)
+  {
+    if (x < half) return join(set(n->nw, x, y, cell), n->ne, n->sw, n->se);
+    return join(n->nw, set(n->ne, x - half, y, cell), n->sw, n->se);
+  }
+  if (x < half) return join(n->nw, n->ne, set(n->sw, x, y - half, cell), n->se);
+  return join(n->nw, n->ne, n->sw, set(n->se, x - half, y - half, cell));
+}
+
+// One generation of the middle 2x2 of a 4x4 node, done by brute force
+HashLife::Node* HashLife::base(Node* n)
+{
+  // Bit x + 4y is the cell at x, y
+  unsigned int bits{ 0 };
+  Node* const quadrants[4] = { n->nw, n->ne, n->sw, n->se };
+  for (int q = 0; q < 4; q++)
+  {
+    const int qx = (q & 1) * 2, qy = (q >> 1) * 2;
+    const Node* const quad = quadrants[q];
+    bits |= static_cast<unsigned int>(quad->nw->population) << (qx + qy * 4);
+    bits |= static_cast<unsigned int>(quad->ne->population) << (qx + 1 + qy * 4);
+    bits |= static_cast<unsigned int>(quad->sw->population) << (qx + (qy + 1) * 4);
+    bits |= static_cast<unsigned int>(quad->se->population) << (qx + 1 + (qy + 1) * 4);
+  }
+
+  const auto lives = [this, bits](int x, int y) {
+    int neighbours{ 0 };
+    for (int dy = -1; dy <= 1; dy++)
+      for (int dx = -1; dx <= 1; dx++)
+        if (dx || dy) neighbours += (bits >> (x + dx + (y + dy) * 4)) & 1;
+    const bool isAlive = (bits >> (x + y * 4)) & 1;
+    return rule.lives(isAlive, neighbours);
+  };
+
+  return join(leaf(lives(1, 1)), leaf(lives(2, 1)), leaf(lives(1, 2)), leaf(lives(2, 2)));
+}
+
+// The centre of a 2^k node advanced by 2^min(stepExponent, k-2) generations
+HashLife::Node* HashLife::next(Node* n)
+{
+  if (n->result) return n->result;
+  if (n->population == 0) return n->result = empty(n->level - 1);
+  if (n->level == 2) return n->result = base(n);
+
+  // Nine overlapping 2^(k-1) nodes covering the node
+  Node* const m00 = n->nw;
+  Node* const m01 = join(n->nw->ne, n->ne->nw, n->nw->se, n->ne->sw);
+  Node* const m02 = n->ne;
+  Node* const m10 = join(n->nw->sw, n->nw->se, n->sw->nw, n->sw->ne);
+  Node* const m11 = centre(n);
+  Node* const m12 = join(n->ne->sw, n->ne->se, n->se->nw, n->se->ne);
+  Node* const m20 = n->sw;
+  Node* const m21 = join(n->sw->ne, n->se->nw, n->sw->se, n->se->sw);
+  Node* const m22 = n->se;
+
+  // Going at full speed both halves of the step advance 2^(k-3) generations,
+  // otherwise the first half only moves to the centre and the second does the whole step
+  const bool fullSpeed = n->level - 2 <= stepExponent;
+  const auto half = [&](Node* m) { return fullSpeed ? next(m) : centre(m); };
+
+  Node* const a00 = half(m00);
+  Node* const a01 = half(m01);
+  Node* const a02 = half(m02);
+  Node* const a10 = half(m10);
+  Node* const a11 = half(m11);
+  Node* const a12 = half(m12);
+  Node* const a20 = half(m20);
+  Node* const a21 = half(m21);
+  Node* const a22 = half(m22);
+
+  return n->result = join(
+    next(join(a00, a01, a10, a11)),
+    next(join(a01, a02, a11, a12)),
+    next(join(a10, a11, a20, a21)),
+    next(join(a11, a12, a21, a22)));
+}
+
+// Doubles the size of the universe keeping the root in the middle
+void HashLife::expand()
+{
+  Node* const e = empty(root->level - 1);
+  const std::int64_t quarter = std::int64_t{ 1 } << (root->level - 1);
+  root = join(
+    join(e, e, e, root->nw),
+    join(e, e, root->ne, e),
+    join(e, root->sw, e, e),
+    join(root->se, e, e, e));
+  originX -= quarter;
+  originY -= quarter;
+}
+
+// Whether everything alive is in the middle half of the root
+bool HashLife::fitsInCentre() const
+{
+  return root->nw->population == root->nw->se->population
+    && root->ne->population == root->ne->sw->population
+    && root->sw->population == root->sw->ne->population
+    && root->se->population == root->se->nw->population;
+}
+
+void HashLife::nextGen()
+{
+  if (nodes.size() > maxNodes) collect();
+
+  // The step must fit in a single result and whatever the pattern grows into
+  // must still be inside the root's centre afterwards
+  while (root->level < stepExponent + 2 || !fitsInCentre()) expand();
+  expand();
+
+  const std::int64_t quarter = std::int64_t{ 1 } << (root->level - 2);
+  root = next(root);
+  originX += quarter;
+  originY += quarter;
+
+  generation += std::uint64_t{ 1 } << stepExponent;
+}
+
+void HashLife::setStepExponent(int e)
+{
+  if (e < 0) e = 0;
+  if (e > 48) e = 48;
+  if (e == stepExponent) return;
+
+  forgetResults(e < stepExponent ? e : stepExponent);
+  stepExponent = e;
+}
+
+void HashLife::setRule(const Rule& r)
+{
+  if (r == rule) return;
+
+  LifeEngine::setRule(r);
+  forgetResults(-1);
+}
+
+// A 2^k node's result advances 2^min(step, k-2) generations,
+// so only the nodes small enough to go at full speed with both steps keep theirs
+void HashLife::forgetResults(int smallerExponent)
+{
+  for (auto& n : nodes)
+    if (n.level - 2 > smallerExponent)
+      n.result = nullptr;
+}
+
+// Throws away every node that isn't part of the current universe
+void HashLife::collect()
+{
+  std::deque<Node> oldNodes;
+  oldNodes.swap(nodes);
+  Node* const oldRoot = root;
+  Node* const oldAlive = alive;
+
+  const auto oldOriginX = originX, oldOriginY = originY;
+  const auto oldGeneration = generation;
+  reset();
+
+  std::unordered_map<Node*, Node*> copies;
+  const auto copy = [&](auto& self, Node* n) -> Node* {
+    if (n->level == 0) return n == oldAlive ? alive : dead;
+    if (n->population == 0) return empty(n->level);
+
+    const auto found = copies.find(n);
+    if (found != copies.end()) return found->second;
+
+    Node* const c = join(self(self, n->nw), self(self, n->ne), self(self, n->sw), self(self, n->se));
+    copies.emplace(n, c);
+    return c;
+  };
+
+  root = copy(copy, oldRoot);
+  originX = oldOriginX;
+  originY = oldOriginY;
+  generation = oldGeneration;
+}
+
+void HashLife::setCell(std::int64_t x, std::int64_t y)
+{
+  for (;;)
+  {
+    const std::int64_t size = std::int64_t{ 1 } << root->level;
+    if (x >= originX && y >= originY && x < originX + size && y < originY + size) break;
+    expand();
+  }
+  root = set(root, x - originX, y - originY, alive);
+}
+
+void HashLife::unsetCell(std::int64_t i, std::int64_t j)
+{
+  if (!isAlive(i, j)) return;
+  root = set(root, i - originX, j - originY, dead);
+}
+
+bool HashLife::isAlive(std::int64_t i, std::int64_t j) const
+{
+  std::int64_t x = i - originX;
+  std::int64_t y = j - originY;
+  const std::int64_t size = std::int64_t{ 1 } << root->level;
+  if (x < 0 || y < 0 || x >= size || y >= size) return false;
+
+  const Node* n = root;
+  while (n->level > 0 && n->population)
+  {
+    const std::int64_t half = std::int64_t{ 1 } << (n->level - 1);
+    if (y < half) n = x < half ? n->nw : n->ne;
+    else n = x < half ? n->sw : n->se;
+    if (x >= half) x -= half;
+    if (y >= half) y -= half;
+  }
+  return n->population;
+}
+
+void HashLife::forEachLive(const std::function<void(std::int64_t, std::int64_t)>& f) const
+{
+  forEachLive(root, originX, originY, f);
+}
+
+// Empty nodes are skipped so this only visits the live part of the tree
+void HashLife::forEachLive(const Node* n, std::int64_t x, std::int64_t y,
+  const std::function<void(std::int64_t, std::int64_t)>& f) const
+{
+  if (n->population == 0) return;
+  if (n->level == 0)
+  {
+    f(x, y);
+    return;
+  }
+
+  const std::int64_t half = std::int64_t{ 1 } << (n->level - 1);
+  forEachLive(n->nw, x, y, f);
+  forEachLive(n->ne, x + half, y, f);
+  forEachLive(n->sw, x, y + half, f);
+  forEachLive(n->se, x + half, y + half, f);
+}
+
+// Only nodes that could still stretch the box are visited, which is a few paths down
+// the tree along each edge of the pattern
+LifeEngine::Box HashLife::boundingBox() const
+{
+  Box box{ INT64_MAX, INT64_MAX, INT64_MIN, INT64_MIN };
+  growBox(root, originX, originY, box);
+  if (box.empty()) box = { 0, 0, 0, 0 };
+  return box;
+}
+
+void HashLife::growBox(const Node* n, std::int64_t x, std::int64_t y, Box& box) const
+{
+  if (n->population == 0) return;
+
+  const std::int64_t size = std::int64_t{ 1 } << n->level;
+  if (x >= box.left && y >= box.top && x + size <= box.right && y + size <= box.bottom) return;
+
+  if (n->level == 0)
+  {
+    box.left = std::min(box.left, x);
+    box.top = std::min(box.top, y);
+    box.right = std::max(box.right, x + 1);
+    box.bottom = std::max(box.bottom, y + 1);
+    return;
+  }
+
+  const std::int64_t half = size / 2;
+  growBox(n->nw, x, y, box);
+  growBox(n->ne, x + half, y, box);
+  growBox(n->sw, x, y + half, box);
+  growBox(n->se, x + half, y + half, box);
+}
+
+// Only the nodes that are in the rectangle and not empty are visited,
+// so a view of a big pattern costs what's in the view
+Bitmap HashLife::exportBitmap(std::int64_t left, std::int64_t top, std::size_t width, std::size_t height) const
+{
+  Bitmap bitmap(left, top, width, height);
+  copyCells(root, originX, originY, bitmap);
+  return bitmap;
+}
+
+void HashLife::copyCells(const Node* n, std::int64_t x, std::int64_t y, Bitmap& bitmap) const
+{
+  if (n->population == 0) return;
+
+  const std::int64_t size = std::int64_t{ 1 } << n->level;
+  if (x + size <= bitmap.x || y + size <= bitmap.y
+    || x >= bitmap.x + static_cast<std::int64_t>(bitmap.w) || y >= bitmap.y + static_cast<std::int64_t>(bitmap.h))
+    return;
+
+  if (n->level == 0)
+  {
+    bitmap.set(x, y);
+    return;
+  }
+
+  const std::int64_t half = size / 2;
+  copyCells(n->nw, x, y, bitmap);
+  copyCells(n->ne, x + half, y, bitmap);
+  copyCells(n->sw, x, y + half, bitmap);
+  copyCells(n->se, x + half, y + half, bitmap);
+}
+
+// Every node knows its population, so a block is added up from a few nodes and
+// only the nodes above it that are in the rectangle and not empty are visited
+Density HashLife::exportDensity(std::int64_t left, std::int64_t top, std::size_t width, std::size_t height, int level) const
+{
+  Density density(left, top, width, height, level);
+  countBlocks(root, originX, originY, density);
+  return density;
+}
+
+void HashLife::countBlocks(const Node* n, std::int64_t x, std::int64_t y, Density& density) const
+{
+  if (n->population == 0) return;
+
+  const std::int64_t size = std::int64_t{ 1 } << n->level;
+  const std::int64_t block = std::int64_t{ 1 } << density.level;
+  if (x + size <= density.x * block || y + size <= density.y * block
+    || x >= (density.x + static_cast<std::int64_t>(density.w)) * block
+    || y >= (density.y + static_cast<std::int64_t>(density.h)) * block)
+    return;
+
+  // The root can be anywhere, so a node can straddle blocks even if it's smaller than one
+  if (density.blockOf(x) == density.blockOf(x + size - 1) && density.blockOf(y) == density.blockOf(y + size - 1))
+  {
+    density.add(density.blockOf(x), density.blockOf(y), static_cast<std::uint32_t>(n->population));
+    return;
+  }
+
+  const std::int64_t half = size / 2;
+  countBlocks(n->nw, x, y, density);
+  countBlocks(n->ne, x + half, y, density);
+  countBlocks(n->sw, x, y + half, density);
+  countBlocks(n->se, x + half, y + half, density);
+}
+
+// Builds the tree straight from the bitmap instead of setting one cell at a time
+void HashLife::importBitmap(const Bitmap& bitmap)
+{
+  reset();
+
+  int level{ 3 };
+  while ((std::size_t{ 1 } << level) < bitmap.w || (std::size_t{ 1 } << level) < bitmap.h) level++;
+
+  root = build(bitmap, bitmap.x, bitmap.y, level);
+  originX = bitmap.x;
+  originY = bitmap.y;
+}
+
+// The 2^level node whose top left cell is at x, y
+HashLife::Node* HashLife::build(const Bitmap& bitmap, std::int64_t x, std::int64_t y, int level)
+{
+  const std::int64_t size = std::int64_t{ 1 } << level;
+  if (x >= bitmap.x + static_cast<std::int64_t>(bitmap.w) || y >= bitmap.y + static_cast<std::int64_t>(bitmap.h)
+    || x + size <= bitmap.x || y + size <= bitmap.y)
+    return empty(level);
+
+  if (level == 0) return leaf(bitmap.get(x, y));
+
+  // Most of a sparse pattern is empty 64x64 squares, which are a single word per row
+  if (level == 6)
+  {
+    std::uint64_t any{ 0 };
+    for (std::int64_t j = 0; j < 64; j++) any |= bitmap.read(x, y + j);
+    if (!any) return empty(level);
+  }
+
+  const std::int64_t half = size / 2;
+  return join(
+    build(bitmap, x, y, level - 1),
+    build(bitmap, x + half, y, level - 1),
+    build(bitmap, x, y + half, level - 1),
+    build(bitmap, x + half, y + half, level - 1));
+}
+
+void HashLife::setDimensions(std::size_t i, std::size_t j)
+{
+  exists = true;
+  w = i;
+  h = j;
+  reset();
+}
+
+void HashLife::destroy()
+{
+  exists = false;
+  reset();
+}
+
+void HashLife::clear()
+{
+  if (!exists) return;
+
+  reset();
+}
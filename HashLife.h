@@ -0,0 +1,133 @@
+#ifndef HASHLIFE_H
+#define HASHLIFE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include "LifeEngine.h"
+
+// Gosper's HashLife.
+// The universe is a quadtree whose nodes are hash consed, so every distinct
+// square of cells exists only once, and each node remembers its own future:
+// the centre of a 2^k node 2^(k-2) generations later. Repeating patterns
+// reuse those results so they can be advanced by huge steps at once.
+// The universe is unbounded, width and height are only used to draw it.
+class HashLife : public LifeEngine
+{
+  struct Node
+  {
+    Node* nw;
+    Node* ne;
+    Node* sw;
+    Node* se;
+    // Centre of this node advanced by the current step, if it's been worked out
+    Node* result;
+    std::uint64_t population;
+    int level; // the node is 2^level cells wide
+  };
+
+  struct Children
+  {
+    Node* nw;
+    Node* ne;
+    Node* sw;
+    Node* se;
+
+    bool operator==(const Children& o) const
+    {
+      return nw == o.nw && ne == o.ne && sw == o.sw && se == o.se;
+    }
+  };
+
+  struct ChildrenHash
+  {
+    std::size_t operator()(const Children& c) const
+    {
+      auto h = reinterpret_cast<std::uintptr_t>(c.nw);
+      h = h * 31 + reinterpret_cast<std::uintptr_t>(c.ne);
+      h = h * 31 + reinterpret_cast<std::uintptr_t>(c.sw);
+      h = h * 31 + reinterpret_cast<std::uintptr_t>(c.se);
+      return static_cast<std::size_t>(h ^ h >> 17);
+    }
+  };
+
+  std::deque<Node> nodes;
+  std::unordered_map<Children, Node*, ChildrenHash> table;
+  std::vector<Node*> empties; // empty node of every level
+
+  Node* dead{ nullptr };
+  Node* alive{ nullptr };
+
+  Node* root{ nullptr };
+  // Universe coordinates of the root's top left corner
+  std::int64_t originX{ 0 };
+  std::int64_t originY{ 0 };
+
+  int stepExponent{ 0 }; // nextGen advances 2^stepExponent generations
+  std::uint64_t generation{ 0 };
+  std::size_t maxNodes{ 1 << 22 };
+
+  bool exists{ false };
+  std::size_t w{ 0 };
+  std::size_t h{ 0 };
+
+  void reset();
+  Node* leaf(bool isAlive) const { return isAlive ? alive : dead; }
+  Node* join(Node* nw, Node* ne, Node* sw, Node* se);
+  Node* empty(int level);
+  Node* centre(Node* n);
+  Node* set(Node* n, std::int64_t x, std::int64_t y, Node* cell);
+  Node* next(Node* n);
+  Node* base(Node* n);
+  void expand();
+  bool fitsInCentre() const;
+  void collect();
+  void forgetResults(int smallerExponent);
+  Node* build(const Bitmap& bitmap, std::int64_t x, std::int64_t y, int level);
+  void forEachLive(const Node* n, std::int64_t x, std::int64_t y,
+    const std::function<void(std::int64_t, std::int64_t)>& f) const;
+  void countBlocks(const Node* n, std::int64_t x, std::int64_t y, Density& density) const;
+  void copyCells(const Node* n, std::int64_t x, std::int64_t y, Bitmap& bitmap) const;
+  void growBox(const Node* n, std::int64_t x, std::int64_t y, Box& box) const;
+
+public:
+  HashLife();
+
+  void setCell(std::int64_t i, std::int64_t j) override;
+  void unsetCell(std::int64_t i, std::int64_t j) override;
+  bool isAlive(std::int64_t i, std::int64_t j) const override;
+
+  // Advances the universe by 2^stepExponent generations
+  void nextGen() override;
+
+  void forEachLive(const std::function<void(std::int64_t, std::int64_t)>& f) const override;
+  std::uint64_t population() const override { return root->population; }
+  Box boundingBox() const override;
+  Bitmap exportBitmap(std::int64_t left, std::int64_t top, std::size_t width, std::size_t height) const override;
+  Density exportDensity(std::int64_t left, std::int64_t top, std::size_t width, std::size_t height, int level) const override;
+  void importBitmap(const Bitmap& bitmap) override;
+
+  // Every result was found with the old rule
+  void setRule(const Rule& r) override;
+
+  void setStepExponent(int e);
+  int getStepExponent() const { return stepExponent; }
+  std::uint64_t getGeneration() const { return generation; }
+
+  // Nodes are collected once there are more than this many
+  void setMaxNodes(std::size_t n) { maxNodes = n; }
+
+  void setDimensions(std::size_t i, std::size_t j) override;
+  void setDimensions(std::size_t i) { setDimensions(i, i); }
+  std::size_t getWidth() const override { return w; }
+  std::size_t getHeight() const override { return h; }
+  void destroy() override;
+  void clear() override;
+  bool exist() const override { return exists; }
+  bool hasEdges() const override { return false; }
+};
+
+#endif
@@ -1,8 +1,17 @@
 #include "Life.h"
 
+#include "BitCells.h"
+#include "Cells.h"
+#include "LutCells.h"
+#include "SparseCells.h"
+
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <cmath>
+#include <memory>
 #include <string>
 
 bool Life::OnUserCreate()
@@ -20,12 +29,28 @@ bool Life::OnUserUpdate(float fElapsedTime)
 {
   //Clear(olc::BLANK);
 
-  if (GetKey(olc::Key::ESCAPE).bPressed)
+  // Everything drawn comes from the newest snapshot, the engine is busy on its own thread
+  simulation.poll();
+  const bool fresh = simulation.update();
+  const Snapshot& shot = simulation.snapshot();
+
+  if (fastForwarding)
+  {
+    // Escape stops a fast-forward where it's got to instead of opening the menu
+    if (GetKey(olc::Key::ESCAPE).bPressed) simulation.stopFastForward();
+    if (shot.fastForward != fastForwardId || shot.fastForwarding)
+    {
+      drawFastForward(shot);
+      return true;
+    }
+    fastForwarding = false;
+  }
+  else if (GetKey(olc::Key::ESCAPE).bPressed)
   {
     paused = true;
 
     if (!menu.isOpen()) menu.open();
-    else if (cells.exist()) menu.close();
+    else if (engine->exist()) menu.close();
   }
 
   // Speed up/down
@@ -39,15 +64,20 @@ bool Life::OnUserUpdate(float fElapsedTime)
     frameDuration += fElapsedTime;
     if (frameDuration > 1.0f) frameDuration = 1.0f;
   }
+  simulation.setInterval(frameDuration);
 
   // Change Cell draw type
-  if (GetKey(olc::Key::D).bPressed)
-    cdt = Life::CellDrawType::dots;
-  else if (GetKey(olc::Key::S).bPressed)
-    cdt = Life::CellDrawType::squares;
+  if (!menu.isTyping())
+  {
+    if (GetKey(olc::Key::D).bPressed)
+      cdt = Life::CellDrawType::dots;
+    else if (GetKey(olc::Key::S).bPressed)
+      cdt = Life::CellDrawType::squares;
+  }
 
   if (menu.isOpen())
   {
+    simulation.setRunning(false);
     menu.update(this, fElapsedTime);
 
     return true;
@@ -62,52 +92,101 @@ bool Life::OnUserUpdate(float fElapsedTime)
 
   // Randomize
   if (GetKey(olc::Key::R).bPressed)
-    randomize();
+    simulation.change([&] { randomize(); });
 
   // Clear
   if (GetKey(olc::Key::C).bPressed)
-    cells.clear();
+    simulation.change([&] { engine->clear(); });
 
-  // Add/Remove Tiles
+  // Auto-pause
+  if (GetKey(olc::Key::P).bPressed)
+  {
+    autoPause = !autoPause;
+    settledGens = 0;
+    simulation.change([&] { hashIfWatched(); });
+  }
+
+  // Jump ahead, which only takes a few generations once the grid repeats itself
+  if (GetKey(olc::Key::J).bPressed && shot.period)
+    simulation.change([&] { if (cells()) cells()->skip(jumpGens); });
+
+  // HashLife step size
+  const int oldStepExponent = stepExponent;
+  if (GetKey(olc::Key::UP).bPressed && stepExponent < 48)
+    stepExponent++;
+  if (GetKey(olc::Key::DOWN).bPressed && stepExponent > 0)
+    stepExponent--;
+  if (stepExponent != oldStepExponent)
+    simulation.change([&] { if (hashLife()) hashLife()->setStepExponent(stepExponent); });
+
+  // Add/Remove Tiles, set between generations
   const auto& view = cam.getView();
   const auto mouseTile = view.GetTileUnderScreenPos(GetMousePos());
 
-  const auto isMouseInGrid = mouseTile.x >= 0 && mouseTile.y >= 0 && mouseTile.x < gridDimensions.x && mouseTile.y < gridDimensions.y;
+  // Engines without edges take cells anywhere
+  const auto isMouseInGrid = !engine->hasEdges()
+    || (mouseTile.x >= 0 && mouseTile.y >= 0 && mouseTile.x < gridDimensions.x && mouseTile.y < gridDimensions.y);
 
   if (GetMouse(0).bPressed && isMouseInGrid)
   {
-    drawMode = !cells.isAlive(mouseTile.x, mouseTile.y);
+    drawMode = !shot.cells.get(mouseTile.x, mouseTile.y);
     paused = true;
-    frameTimer = 0.0f;
+    lastEdit = { -1, -1 };
   }
 
   if (GetMouse(0).bHeld && isMouseInGrid)
   {
-    if (drawMode) cells.setCell(mouseTile.x, mouseTile.y);
-    else cells.unsetCell(mouseTile.x, mouseTile.y);
+    if (mouseTile != lastEdit) simulation.edit(mouseTile.x, mouseTile.y, drawMode);
+    lastEdit = mouseTile;
     paused = true;
-    frameTimer = 0.0f;
   }
 
-  if (!paused)
-  {
-    // Update frame
-    if (frameTimer > frameDuration) {
+  simulation.setRunning(!paused);
+  const auto tl = view.GetTopLeftTile(), br = view.GetBottomRightTile();
+  simulation.setView(tl.x, tl.y, br.x + 1, br.y + 1, cam.densityLevel());
 
-      cells.nextGen();
-      frameTimer = std::fmod(frameTimer, frameDuration);
+  // Cells knows its population without counting so it can be checked every snapshot,
+  // and notices when its grid repeats itself
+  if (fresh && shot.counted)
+  {
+    const auto gens = shot.generation - lastGeneration;
+    settledGens = shot.population == lastPopulation ? settledGens + gens : 0;
+    lastPopulation = shot.population;
+    lastGeneration = shot.generation;
+    if (!paused && autoPause && (settledGens >= settledAfter || (shot.period && !lastPeriod)))
+    {
+      paused = true;
+      simulation.setRunning(false);
+      settledGens = 0;
     }
-    frameTimer += fElapsedTime;
+    lastPeriod = shot.period;
   }
 
   const olc::Pixel backgroundColour( bgR, bgG, bgB );
   Clear(backgroundColour);
 
+  // The grid is a decal, so anything on top of it has to be one too
   cam.draw(this, fElapsedTime);
 
   if (paused)
   {
-    DrawString({ 10, 10 }, "Paused", olc::WHITE, 2U);
+    DrawStringDecal({ 10, 10 }, "Paused", olc::WHITE, { 2.0f, 2.0f });
+  }
+
+  if (hashLife())
+  {
+    DrawStringDecal({ 10.0f, ScreenHeight() - 26.0f }, "HashLife step: 2^" + std::to_string(stepExponent)
+      + "  generation: " + std::to_string(shot.generation), olc::WHITE, { 2.0f, 2.0f });
+  }
+
+  if (shot.counted)
+  {
+    DrawStringDecal({ 10.0f, ScreenHeight() - 26.0f }, "Population: " + std::to_string(shot.population)
+      + "  born: " + std::to_string(shot.births) + "  died: " + std::to_string(shot.deaths)
+      + (autoPause ? "  (auto-pause)" : ""), olc::WHITE, { 2.0f, 2.0f });
+
+    DrawStringDecal({ 10.0f, ScreenHeight() - 52.0f }, "Generation: " + std::to_string(shot.generation)
+      + (shot.period ? "  repeats every " + std::to_string(shot.period) : ""), olc::WHITE, { 2.0f, 2.0f });
   }
 
   return true;
@@ -117,9 +196,7 @@ void Life::newGrid(int i, int j)
 {
   gridDimensions = { i, j };
 
-  cells.setDimensions(gridDimensions.x, gridDimensions.y);
-
-  cells.clear();
+  engine->setDimensions(gridDimensions.x, gridDimensions.y);
 
   randomize();
 
@@ -128,16 +205,105 @@ void Life::newGrid(int i, int j)
 
 void Life::randomize()
 {
-  if (!cells.exist()) return;
+  if (!engine->exist()) return;
 
-  cells.clear();
+  engine->clear();
   for (auto j = 0; j < gridDimensions.y; j++)
     for (auto i = 0; i < gridDimensions.x; i++)
     {
-      if (rand() % 100 < lifeChance) cells.setCell(i, j);
-      else cells.unsetCell(i, j);
+      if (rand() % 100 < lifeChance) engine->setCell(i, j);
     }
-  frameTimer = .0f;
+}
+
+void Life::fastForward(std::uint64_t gens, float seconds)
+{
+  fastForwarding = true;
+  fastForwardId = simulation.fastForward(gens, seconds);
+  paused = true;
+}
+
+void Life::drawFastForward(const Snapshot& shot)
+{
+  // Until the simulation picks it up, nothing's done yet
+  const bool started = shot.fastForward == fastForwardId;
+  const std::uint64_t done = started ? shot.fastForwardDone : 0;
+  const std::uint64_t total = started ? shot.fastForwardTotal : 0;
+  const float elapsed = started ? shot.fastForwardElapsed : 0.0f;
+  const float budget = started ? shot.fastForwardBudget : 0.0f;
+
+  float progress{ 0.0f };
+  if (total) progress = static_cast<float>(done) / static_cast<float>(total);
+  if (budget > 0.0f && elapsed / budget > progress) progress = elapsed / budget;
+  if (progress > 1.0f) progress = 1.0f;
+
+  Clear(olc::Pixel(bgR, bgG, bgB));
+  const olc::vi2d barPos{ 40, ScreenHeight() / 2 - 20 };
+  const olc::vi2d barSize{ ScreenWidth() - 80, 40 };
+  FillRect(barPos, { static_cast<int>(barSize.x * progress), barSize.y }, olc::Pixel(cR, cG, cB));
+  DrawRect(barPos, barSize, olc::WHITE);
+
+  std::string text = "Fast-forwarding: " + std::to_string(done);
+  if (total) text += " of " + std::to_string(total);
+  text += hashLife() ? " steps" : " generations";
+  text += ", " + std::to_string(static_cast<int>(elapsed)) + " s";
+  if (budget > 0.0f) text += " of " + std::to_string(static_cast<int>(budget));
+  DrawString(barPos - olc::vi2d{ 0, 30 }, text, olc::WHITE, 2U);
+  DrawString(barPos + olc::vi2d{ 0, barSize.y + 14 }, "Escape to stop", olc::WHITE, 2U);
+}
+
+std::unique_ptr<LifeEngine> Life::makeEngine(EngineType type)
+{
+  switch (type)
+  {
+  case EngineType::bitCells: return std::make_unique<BitCells>();
+  case EngineType::hashLife: return std::make_unique<HashLife>();
+  case EngineType::sparse: return std::make_unique<SparseCells>();
+  case EngineType::lut: return std::make_unique<LutCells>();
+  default:
+  {
+    auto cells = std::make_unique<Cells>();
+    cells->setEventDriven(type == EngineType::events);
+    return cells;
+  }
+  }
+}
+
+void Life::setEngine(EngineType type)
+{
+  if (type == engineType) return;
+
+  auto next = makeEngine(type);
+  next->setThreadCount(threadCount);
+  next->setRule(engine->getRule());
+  next->setTorus(torus);
+
+  // Only what's inside the grid is carried over, in one go rather than cell by cell
+  if (engine->exist())
+  {
+    next->setDimensions(gridDimensions.x, gridDimensions.y);
+    next->importBitmap(engine->exportBitmap(0, 0, gridDimensions.x, gridDimensions.y));
+  }
+
+  // The old engine is freed here so only one holds memory at a time
+  engine = std::move(next);
+  engineType = type;
+  if (hashLife()) hashLife()->setStepExponent(stepExponent);
+  hashIfWatched();
+}
+
+HashLife* Life::hashLife()
+{
+  return engineType == EngineType::hashLife ? static_cast<HashLife*>(engine.get()) : nullptr;
+}
+
+Cells* Life::cells()
+{
+  return engineType == EngineType::cells || engineType == EngineType::events ? static_cast<Cells*>(engine.get()) : nullptr;
+}
+
+void Life::hashIfWatched()
+{
+  if (cells()) cells()->setHashing(watchRepeats || autoPause);
 }
 
 
@@ -157,7 +323,12 @@ void Life::Camera::smoothDecrease(float& value, float fElapsedTime, float factor
 
 void Life::Camera::update(Life const* const life, float fElapsedTime)
 {
-  const auto& gridDimensions = life->gridDimensions;
+  // Until the first snapshot it's the grid. Floats can't place a cell much further out than 2^24.
+  const auto& bounds = life->simulation.snapshot().bounds;
+  const auto limit = [](std::int64_t n) { return static_cast<int>(std::clamp<std::int64_t>(n, -(1 << 24), 1 << 24)); };
+  worldTL = bounds.empty() ? olc::vi2d{ 0, 0 } : olc::vi2d{ limit(bounds.left), limit(bounds.top) };
+  worldBR = bounds.empty() ? life->gridDimensions : olc::vi2d{ limit(bounds.right), limit(bounds.bottom) };
+  const auto worldSize = worldBR - worldTL;
 
   // Smooth Pan
   if (life->GetMouse(1).bPressed) tv.StartPan(life->GetMousePos());
@@ -183,30 +354,30 @@ void Life::Camera::update(Life const* const life, float fElapsedTime)
 
   olc::vf2d clamped{ tl };
 
-  if ((tl.x <= 0.0f) && (brTile.x >= gridDimensions.x))
+  if ((tl.x <= worldTL.x) && (brTile.x >= worldBR.x))
   {
-    clamped.x = (gridDimensions.x - (br.x - tl.x)) / 2.0f;
+    clamped.x = worldTL.x + (worldSize.x - (br.x - tl.x)) / 2.0f;
   }
-  else if (tl.x <= 0.0f)
+  else if (tl.x <= worldTL.x)
   {
-    clamped.x = 0.0f;
+    clamped.x = static_cast<float>(worldTL.x);
   }
-  else if (brTile.x >= gridDimensions.x)
+  else if (brTile.x >= worldBR.x)
   {
-    clamped.x = gridDimensions.x - (br.x - tl.x);
+    clamped.x = worldBR.x - (br.x - tl.x);
   }
 
-  if ((tl.y <= 0.0f) && (brTile.y >= gridDimensions.y))
+  if ((tl.y <= worldTL.y) && (brTile.y >= worldBR.y))
   {
-    clamped.y = (gridDimensions.y - (br.y - tl.y)) / 2.0f;
+    clamped.y = worldTL.y + (worldSize.y - (br.y - tl.y)) / 2.0f;
   }
-  else if (tl.y <= 0.0f)
+  else if (tl.y <= worldTL.y)
   {
-    clamped.y = 0.0f;
+    clamped.y = static_cast<float>(worldTL.y);
   }
-  else if (brTile.y >= gridDimensions.y)
+  else if (brTile.y >= worldBR.y)
   {
-    clamped.y = gridDimensions.y - (br.y - tl.y);
+    clamped.y = worldBR.y - (br.y - tl.y);
   }
 
   if (clamped != tl)
@@ -229,7 +400,9 @@ void Life::Camera::update(Life const* const life, float fElapsedTime)
 
   if (ws.x > 100.0f)
     dZoom = -.01f;
-  else if (ws.x < 1.0f)
+  // Out far enough to see the whole grid, where cells are shown by how many there are in each pixel
+  else if (ws.x < std::min(1.0f, std::min(static_cast<float>(life->ScreenWidth()) / worldSize.x,
+    static_cast<float>(life->ScreenHeight()) / worldSize.y)))
     dZoom = .01f;
 
   if (dZoom > 0.06f) dZoom = 0.06f;
@@ -242,37 +415,220 @@ void Life::Camera::update(Life const* const life, float fElapsedTime)
   prevMousePos = life->GetMousePos();
 }
 
-void Life::Camera::draw(Life const* const life, float fElapsedTime)
+void Life::Camera::makeStamp(Life* const life, int pixels, olc::Pixel colour, CellDrawType type)
+{
+  cellPixels = pixels;
+  stampColour = colour;
+  stampType = type;
+
+  // The same shapes the cells used to be drawn with one by one, for a cell this many pixels wide
+  stamp = std::make_unique<olc::Sprite>(pixels, pixels);
+  life->SetDrawTarget(stamp.get());
+  life->Clear(olc::BLANK);
+  const olc::vi2d centre{ pixels / 2, pixels / 2 };
+  if (type == CellDrawType::dots)
+  {
+    life->FillCircle(centre, static_cast<int32_t>(.3f * pixels), colour);
+  }
+  else if (type == CellDrawType::squares)
+  {
+    const int32_t inset = static_cast<int32_t>(.1f * pixels), side = static_cast<int32_t>(.8f * pixels);
+    life->FillRect({ inset, inset }, { side, side }, colour);
+    life->Draw(centre, colour);
+  }
+  life->SetDrawTarget(nullptr);
+  patternWidth = 0;
+}
+
+void Life::Camera::makePattern()
+{
+  patternWidth = gridSprite->width;
+  patternRows.clear();
+  stampPattern.clear();
+  for (int y = 0; y < cellPixels; y++)
+  {
+    bool empty{ true };
+    for (int x = 0; x < cellPixels; x++) empty &= stamp->GetPixel(x, y).a == 0;
+    if (empty) continue;
+
+    patternRows.push_back(y);
+    for (int x = 0; x < patternWidth; x++) stampPattern.push_back(stamp->GetPixel(x % cellPixels, y));
+  }
+}
+
+int Life::Camera::densityLevel() const
+{
+  // Blocks about a pixel wide
+  const float ws = tv.GetWorldScale().x;
+  return ws < 1.0f ? std::max(0, static_cast<int>(std::lround(-std::log2(ws)))) : 0;
+}
+
+bool Life::Camera::fitSprite(const olc::vi2d& size)
+{
+  if (gridSprite && gridSprite->width == size.x && gridSprite->height == size.y) return false;
+
+  gridSprite = std::make_unique<olc::Sprite>(size.x, size.y);
+  gridDecal = std::make_unique<olc::Decal>(gridSprite.get());
+  return true;
+}
+
+void Life::Camera::draw(Life* const life, float fElapsedTime)
 {
-  const auto& gridDimensions = life->gridDimensions;
-  const auto& cdt = life->cdt;
-  const auto& cells = life->cells;
   const olc::Pixel colour( life->cR, life->cG, life->cB );
+  const Snapshot& shot = life->simulation.snapshot();
+
+  const auto tl = tv.GetTopLeftTile().max(worldTL);
+  const auto br = tv.GetBottomRightTile().min(worldBR);
+  if (br.x <= tl.x || br.y <= tl.y) return;
+
+  // Whatever the snapshot has, which is a level behind for a moment after zooming past one
+  if (shot.density.level) drawDensity(shot, tl, br, colour);
+  else drawCells(life, shot, tl, br, colour);
+}
 
-  const auto tl = tv.GetTopLeftTile().max({ 0, 0 });
-  const auto br = tv.GetBottomRightTile().min(gridDimensions);
+void Life::Camera::drawCells(Life* const life, const Snapshot& shot, const olc::vi2d& tl, const olc::vi2d& br, olc::Pixel colour)
+{
+  // Whole pixels a cell, at least as many as on screen so the decal is only ever scaled down a little
+  const int pixels = std::max(1, static_cast<int>(std::ceil(tv.GetWorldScale().x)));
 
-  olc::vi2d tile;
+  // Anything but a new snapshot means drawing the lot again
+  bool redraw = tl != drawnTL || drawnLevel != 0;
+  if (!stamp || pixels != cellPixels || colour != stampColour || life->cdt != stampType)
+  {
+    makeStamp(life, pixels, colour, life->cdt);
+    redraw = true;
+  }
+  redraw |= fitSprite((br - tl) * pixels);
+  if (patternWidth != gridSprite->width) makePattern();
 
-  if (cdt == Life::CellDrawType::dots)
-    for (tile.y = tl.y; tile.y < br.y; tile.y++)
-      for (tile.x = tl.x; tile.x < br.x; tile.x++)
+  // Otherwise only the tiles that changed since the one drawn, if the snapshot knows them
+  if (!redraw && shot.serial != drawnSerial && (!drawnComplete || !shot.changedSince || shot.changedSince != drawnSerial))
+    redraw = true;
+
+  if (!redraw && shot.serial == drawnSerial)
+  {
+    tv.DrawDecal(olc::vf2d(tl), gridDecal.get(), { 1.0f / pixels, 1.0f / pixels });
+    return;
+  }
+
+  olc::Pixel* const data = gridSprite->GetData();
+  if (redraw)
+  {
+    std::fill_n(data, gridSprite->width * gridSprite->height, olc::BLANK);
+    stampCells(shot, tl, tl, br);
+  }
+  else
+  {
+    for (int ty = tl.y / 64; ty * 64 < br.y; ty++)
+      for (int tx = tl.x / 64; tx * 64 < br.x; tx++)
       {
-        if (cells.isAlive(tile.x, tile.y))
-        {
-          tv.FillCircle(olc::vf2d(tile) + olc::vf2d{ .5f, .5f }, .3f, colour);
-        }
+        if (!shot.changed.get(tx, ty)) continue;
+
+        const olc::vi2d from = olc::vi2d{ tx * 64, ty * 64 }.max(tl);
+        const olc::vi2d to = olc::vi2d{ tx * 64 + 64, ty * 64 + 64 }.min(br);
+        for (int y = (from.y - tl.y) * pixels; y < (to.y - tl.y) * pixels; y++)
+          std::fill_n(data + y * gridSprite->width + (from.x - tl.x) * pixels, (to.x - from.x) * pixels, olc::BLANK);
+        stampCells(shot, tl, from, to);
       }
-  else if (cdt == Life::CellDrawType::squares)
-    for (tile.y = tl.y; tile.y < br.y; tile.y++)
-      for (tile.x = tl.x; tile.x < br.x; tile.x++)
+  }
+  gridDecal->Update();
+
+  drawnSerial = shot.serial;
+  drawnTL = tl;
+  drawnLevel = 0;
+  drawnComplete = shot.cells.inside(tl.x, tl.y) && shot.cells.inside(br.x - 1, br.y - 1);
+  life->simulation.drawn(shot.serial);
+
+  tv.DrawDecal(olc::vf2d(tl), gridDecal.get(), { 1.0f / pixels, 1.0f / pixels });
+}
+
+void Life::Camera::stampCells(const Snapshot& shot, const olc::vi2d& tl, const olc::vi2d& from, const olc::vi2d& to)
+{
+  olc::Pixel* const data = gridSprite->GetData();
+  const int width = gridSprite->width;
+
+  // Cells don't overlap, so the pattern is copied straight in gaps and all,
+  // a row of the shape at a time for the whole run
+  const auto copyRun = [&](int j, int first, int last) {
+    olc::Pixel* const start = data + (j - tl.y) * cellPixels * width + (first - tl.x) * cellPixels;
+    const std::size_t bytes = static_cast<std::size_t>(last - first) * cellPixels * sizeof(olc::Pixel);
+    for (std::size_t r = 0; r < patternRows.size(); r++)
+      std::memcpy(start + patternRows[r] * width, stampPattern.data() + r * patternWidth, bytes);
+  };
+
+  // The zeros below the lowest one, bits can't be 0
+  const auto trailingZeros = [](std::uint64_t bits) {
+    return static_cast<int>(std::bitset<64>((bits & (~bits + 1)) - 1).count());
+  };
+
+  // Runs are found a word at a time, skipping straight over the dead cells and then the live ones
+  for (int j = from.y; j < to.y; j++)
+  {
+    int runStart{ -1 };
+    for (int i = from.x; i < to.x; i += 64)
+    {
+      std::uint64_t bits = shot.cells.read(i, j);
+      if (to.x - i < 64) bits &= (std::uint64_t{ 1 } << (to.x - i)) - 1;
+
+      int b{ 0 };
+      while (b < 64)
       {
-        if (cells.isAlive(tile.x, tile.y))
+        if (runStart < 0)
         {
-          tv.FillRect(olc::vf2d(tile) + olc::vf2d{ .1f, .1f }, { .8f, .8f }, colour);
-          tv.Draw(olc::vf2d(tile) + olc::vf2d{ .5f, .5f }, colour);
+          if (!bits) break;
+          const int dead = trailingZeros(bits);
+          b += dead;
+          bits >>= dead;
+          runStart = i + b;
         }
+
+        // A run to the top of the word can carry on in the next one
+        const int live = ~bits ? trailingZeros(~bits) : 64;
+        b += live;
+        if (b >= 64) break;
+        bits >>= live;
+        copyRun(j, runStart, i + b);
+        runStart = -1;
+      }
+    }
+    if (runStart >= 0) copyRun(j, runStart, to.x);
+  }
+}
+
+void Life::Camera::drawDensity(const Snapshot& shot, const olc::vi2d& tl, const olc::vi2d& br, olc::Pixel colour)
+{
+  const Density& density = shot.density;
+  const int block = 1 << density.level;
+  // Shifts round down left of and above 0 too
+  const olc::vi2d first{ tl.x >> density.level, tl.y >> density.level };
+  const olc::vi2d last{ (br.x + block - 1) >> density.level, (br.y + block - 1) >> density.level };
+
+  bool redraw = shot.serial != drawnSerial || first != drawnTL || density.level != drawnLevel || colour != drawnColour;
+  redraw |= fitSprite(last - first);
+
+  if (redraw)
+  {
+    // A pixel a block, in the cell colour as opaque as the block is full.
+    // The square root keeps the thin ash a soup leaves behind from fading out.
+    const float area = static_cast<float>(block) * static_cast<float>(block);
+    olc::Pixel* const pixels = gridSprite->GetData();
+    for (int by = first.y; by < last.y; by++)
+      for (int bx = first.x; bx < last.x; bx++)
+      {
+        const std::uint32_t n = density.get(bx, by);
+        const float alpha = n ? std::sqrt(std::min(1.0f, static_cast<float>(n) / area)) : 0.0f;
+        pixels[(by - first.y) * gridSprite->width + bx - first.x] =
+          olc::Pixel(colour.r, colour.g, colour.b, static_cast<std::uint8_t>(alpha * 255.0f));
       }
+    gridDecal->Update();
+
+    drawnSerial = shot.serial;
+    drawnTL = first;
+    drawnLevel = density.level;
+    drawnColour = colour;
+  }
+
+  tv.DrawDecal(olc::vf2d(first * block), gridDecal.get(), { static_cast<float>(block), static_cast<float>(block) });
 }
 
 
@@ -342,7 +698,7 @@ void Life::Menu::update(Life* const life, float fElapsedTime)
     if (newGridRows > 0 && newGridCols > 0) {
       gridButtonSelection = olc::DARK_GREEN;
 
-      life->newGrid(newGridRows, newGridCols);
+      life->simulation.change([&] { life->newGrid(newGridRows, newGridCols); });
       newGridRows = newGridCols  = -1;
     }
     else gridButtonSelection = olc::DARK_RED;
@@ -354,18 +710,66 @@ void Life::Menu::update(Life* const life, float fElapsedTime)
   }
   else if (isInRect(getRect(randomizeButton), mousePos) && mouse.bPressed || life->GetKey(olc::Key::R).bPressed)
   {
-    if (life->cells.exist()) populaceButtonSelection = olc::DARK_GREEN;
+    if (life->engine->exist()) populaceButtonSelection = olc::DARK_GREEN;
     else populaceButtonSelection = olc::DARK_RED;
     selected = Selection::randomButton;
-    life->randomize();
+    life->simulation.change([&] { life->randomize(); });
   }
   else if (isInRect(getRect(clearButton), mousePos) && mouse.bPressed || life->GetKey(olc::Key::C).bPressed)
   {
-    if (life->cells.exist()) populaceButtonSelection = olc::DARK_GREEN;
+    if (life->engine->exist()) populaceButtonSelection = olc::DARK_GREEN;
     else populaceButtonSelection = olc::DARK_RED;
     selected = Selection::clearButton;
 
-    life->cells.clear();
+    life->simulation.change([&] { life->engine->clear(); });
+  }
+  else if (isInRect(getRect(threadsInput), mousePos) && mouse.bPressed)
+    selected = Selection::threads;
+  else if (isInRect(getRect(denseButton), mousePos) && mouse.bPressed)
+    life->simulation.change([&] { life->setEngine(EngineType::cells); });
+  else if (isInRect(getRect(bitsButton), mousePos) && mouse.bPressed)
+    life->simulation.change([&] { life->setEngine(EngineType::bitCells); });
+  else if (isInRect(getRect(hashLifeButton), mousePos) && mouse.bPressed)
+    life->simulation.change([&] { life->setEngine(EngineType::hashLife); });
+  else if (isInRect(getRect(sparseButton), mousePos) && mouse.bPressed)
+    life->simulation.change([&] { life->setEngine(EngineType::sparse); });
+  else if (isInRect(getRect(eventsButton), mousePos) && mouse.bPressed)
+    life->simulation.change([&] { life->setEngine(EngineType::events); });
+  else if (isInRect(getRect(lutButton), mousePos) && mouse.bPressed)
+    life->simulation.change([&] { life->setEngine(EngineType::lut); });
+  else if (isInRect(getRect(stepInput), mousePos) && mouse.bPressed)
+    selected = Selection::step;
+  else if (isInRect(getRect(ruleInput), mousePos) && mouse.bPressed)
+    selected = Selection::rule;
+  else if (isInRect(getRect(fastForwardGensInput), mousePos) && mouse.bPressed)
+    selected = Selection::fastForwardGens;
+  else if (isInRect(getRect(fastForwardSecondsInput), mousePos) && mouse.bPressed)
+    selected = Selection::fastForwardSeconds;
+  else if (isInRect(getRect(fastForwardButton), mousePos) && mouse.bPressed)
+  {
+    selected = Selection::fastForwardButton;
+
+    if (life->engine->exist() && (fastForwardGens > 0 || fastForwardSeconds > 0))
+    {
+      fastForwardSelection = olc::DARK_GREEN;
+      life->fastForward(fastForwardGens > 0 ? fastForwardGens : 0, fastForwardSeconds > 0 ? static_cast<float>(fastForwardSeconds) : 0.0f);
+      close();
+    }
+    else fastForwardSelection = olc::DARK_RED;
+  }
+  else if (isInRect(getRect(deadEdgesButton), mousePos) && mouse.bPressed)
+    life->simulation.change([&] { life->engine->setTorus(life->torus = false); });
+  else if (isInRect(getRect(wrapEdgesButton), mousePos) && mouse.bPressed)
+    life->simulation.change([&] { life->engine->setTorus(life->torus = true); });
+  else if (isInRect(getRect(repeatsOffButton), mousePos) && mouse.bPressed)
+  {
+    life->watchRepeats = false;
+    life->simulation.change([&] { life->hashIfWatched(); });
+  }
+  else if (isInRect(getRect(repeatsWatchButton), mousePos) && mouse.bPressed)
+  {
+    life->watchRepeats = true;
+    life->simulation.change([&] { life->hashIfWatched(); });
   }
   else if (isInRect(getRect(cRInp), mousePos) && mouse.bPressed)
     selected = Selection::colR;
@@ -410,14 +814,37 @@ void Life::Menu::update(Life* const life, float fElapsedTime)
   keyInp = life->GetKey(olc::Key::NP9).bPressed ? 9 : keyInp;
   keyInp = life->GetKey(olc::Key::BACK).bPressed ? -1 : keyInp;
 
+  if (selected == Selection::rule)
+  {
+    if (life->GetKey(olc::Key::B).bPressed) typeRule(life, 'B');
+    if (life->GetKey(olc::Key::S).bPressed) typeRule(life, 'S');
+    if (life->GetKey(olc::Key::OEM_2).bPressed) typeRule(life, '/');
+  }
+
   if (keyInp != -2)
   {
-    if (selected == Selection::rows)
+    if (selected == Selection::rule)
+      typeRule(life, keyInp < 0 ? '\0' : static_cast<char>('0' + keyInp));
+    else if (selected == Selection::rows)
       input(keyInp, newGridRows, 9999);
     else if (selected == Selection::columns)
       input(keyInp, newGridCols, 9999);
     else if (selected == Selection::lifeChance)
       input(keyInp, life->lifeChance, 99);
+    else if (selected == Selection::threads)
+    {
+      input(keyInp, life->threadCount, 256);
+      life->simulation.change([&] { life->engine->setThreadCount(life->threadCount); });
+    }
+    else if (selected == Selection::step)
+    {
+      input(keyInp, life->stepExponent, 48);
+      life->simulation.change([&] { if (life->hashLife()) life->hashLife()->setStepExponent(life->stepExponent); });
+    }
+    else if (selected == Selection::fastForwardGens)
+      input(keyInp, fastForwardGens, 999999999);
+    else if (selected == Selection::fastForwardSeconds)
+      input(keyInp, fastForwardSeconds, 86400);
     else if (selected == Selection::colR)
       input(keyInp, life->cR, 255);
     else if (selected == Selection::colG)
@@ -500,6 +927,82 @@ void Life::Menu::update(Life* const life, float fElapsedTime)
   life->FillRect(getRect(Indexes::speed).pos + olc::vi2d{ sliderStart, 5 }, { sliderEnd - sliderStart + 20, 10}, olc::VERY_DARK_GREY);
   drawInputBox(life, speedSlider, "", (speedSlider.dragged || isInRect(getRect(speedSlider), mousePos)) ? olc::WHITE : olc::GREY);
 
+  life->DrawString(getRect(Indexes::threads).pos, "Threads (0 = all cores): ", olc::WHITE, 3);
+  drawInputBox(life, threadsInput, life->threadCount, selected == Selection::threads ? olc::VERY_DARK_GREY : olc::BLANK);
+
+  life->DrawString(getRect(Indexes::engine).pos, "Engine: ", olc::WHITE, 3);
+  drawInputBox(life, denseButton, "Dense",
+    life->engineType == EngineType::cells ? olc::VERY_DARK_CYAN :
+    isInRect(getRect(denseButton), mousePos) ? olc::VERY_DARK_GREY : olc::BLANK
+  );
+  drawInputBox(life, bitsButton, "Bits",
+    life->engineType == EngineType::bitCells ? olc::VERY_DARK_CYAN :
+    isInRect(getRect(bitsButton), mousePos) ? olc::VERY_DARK_GREY : olc::BLANK
+  );
+  drawInputBox(life, hashLifeButton, "HashLife",
+    life->engineType == EngineType::hashLife ? olc::VERY_DARK_CYAN :
+    isInRect(getRect(hashLifeButton), mousePos) ? olc::VERY_DARK_GREY : olc::BLANK
+  );
+  drawInputBox(life, sparseButton, "Sparse",
+    life->engineType == EngineType::sparse ? olc::VERY_DARK_CYAN :
+    isInRect(getRect(sparseButton), mousePos) ? olc::VERY_DARK_GREY : olc::BLANK
+  );
+  drawInputBox(life, eventsButton, "Events",
+    life->engineType == EngineType::events ? olc::VERY_DARK_CYAN :
+    isInRect(getRect(eventsButton), mousePos) ? olc::VERY_DARK_GREY : olc::BLANK
+  );
+  drawInputBox(life, lutButton, "LUT",
+    life->engineType == EngineType::lut ? olc::VERY_DARK_CYAN :
+    isInRect(getRect(lutButton), mousePos) ? olc::VERY_DARK_GREY : olc::BLANK
+  );
+  life->DrawString(getRect(Indexes::hashLifeStep).pos, "HashLife step (2^n): ", olc::WHITE, 3);
+  drawInputBox(life, stepInput, life->stepExponent, selected == Selection::step ? olc::VERY_DARK_GREY : olc::BLANK);
+
+  life->DrawString(getRect(Indexes::rule).pos, "Rule: ", olc::WHITE, 3);
+  drawInputBox(life, ruleInput, ruleText,
+    !ruleValid ? olc::DARK_RED :
+    selected == Selection::rule ? olc::VERY_DARK_GREY : olc::BLANK
+  );
+  life->DrawString(getRect(Indexes::rule).pos + olc::vi2d{ 620, 0 }, "e.g. B36/S23", olc::GREY, 3);
+
+  life->DrawString(getRect(Indexes::edges).pos, "Edges: ", olc::WHITE, 3);
+  drawInputBox(life, deadEdgesButton, "Dead",
+    !life->torus ? olc::VERY_DARK_CYAN :
+    isInRect(getRect(deadEdgesButton), mousePos) ? olc::VERY_DARK_GREY : olc::BLANK
+  );
+  drawInputBox(life, wrapEdgesButton, "Wrap",
+    life->torus ? olc::VERY_DARK_CYAN :
+    isInRect(getRect(wrapEdgesButton), mousePos) ? olc::VERY_DARK_GREY : olc::BLANK
+  );
+  if (life->torus && !life->engine->isTorus())
+    life->DrawString(getRect(Indexes::edges).pos + olc::vi2d{ 500, 0 }, "(Dense and Events only)", olc::GREY, 3);
+  else if (!life->engine->hasEdges())
+    life->DrawString(getRect(Indexes::edges).pos + olc::vi2d{ 500, 0 }, "(none with Sparse or HashLife)", olc::GREY, 3);
+
+  life->DrawString(getRect(Indexes::repeats).pos, "Repeats: ", olc::WHITE, 3);
+  drawInputBox(life, repeatsOffButton, "Off",
+    !life->watchRepeats ? olc::VERY_DARK_CYAN :
+    isInRect(getRect(repeatsOffButton), mousePos) ? olc::VERY_DARK_GREY : olc::BLANK
+  );
+  drawInputBox(life, repeatsWatchButton, "Watch",
+    life->watchRepeats ? olc::VERY_DARK_CYAN :
+    isInRect(getRect(repeatsWatchButton), mousePos) ? olc::VERY_DARK_GREY : olc::BLANK
+  );
+  if (life->watchRepeats && !life->cells())
+    life->DrawString(getRect(Indexes::repeats).pos + olc::vi2d{ 550, 0 }, "(Dense and Events only)", olc::GREY, 3);
+
+  // Generations or seconds, whichever comes first, 0 for no limit
+  auto fastForwardPos = getRect(Indexes::fastForward).pos;
+  life->DrawString(fastForwardPos, "Fast-forward: ", olc::WHITE, 3);
+  drawInputBox(life, fastForwardGensInput, fastForwardGens, selected == Selection::fastForwardGens ? olc::VERY_DARK_GREY : olc::BLANK);
+  life->DrawString(fastForwardPos + olc::vi2d{ 610, 0 }, "or", olc::WHITE, 3);
+  drawInputBox(life, fastForwardSecondsInput, fastForwardSeconds, selected == Selection::fastForwardSeconds ? olc::VERY_DARK_GREY : olc::BLANK);
+  life->DrawString(fastForwardPos + olc::vi2d{ 790, 0 }, "s", olc::WHITE, 3);
+  drawInputBox(life, fastForwardButton, "Go",
+    selected == Selection::fastForwardButton ? fastForwardSelection :
+    isInRect(getRect(fastForwardButton), mousePos) ? olc::VERY_DARK_GREY : olc::BLANK
+  );
+
   life->DrawString(getRect(Indexes::colour).pos, "Colour (RGB): ", olc::WHITE, 3);
   drawInputBox(life, cRInp, life->cR, selected == Selection::colR ? olc::VERY_DARK_GREY : olc::BLANK);
   drawInputBox(life, cGInp, life->cG, selected == Selection::colG ? olc::VERY_DARK_GREY : olc::BLANK);
@@ -541,4 +1044,7 @@ void Life::Menu::update(Life* const life, float fElapsedTime)
   life->DrawString(getRect(Indexes::instructions6).pos, "R to randomize and C to clear", olc::WHITE, 3);
   life->DrawString(getRect(Indexes::instructions7).pos, "Left and Right Arrows to change simulation speed", olc::WHITE, 3);
   life->DrawString(getRect(Indexes::instructions8).pos, "S and D to switch between dots and squares", olc::WHITE, 3);
+  life->DrawString(getRect(Indexes::instructions12).pos, "Up and Down Arrows to change the HashLife step", olc::WHITE, 3);
+  life->DrawString(getRect(Indexes::instructions13).pos, "P to pause when the grid settles or repeats", olc::WHITE, 3);
+  life->DrawString(getRect(Indexes::instructions14).pos, "J to jump a million generations when repeating", olc::WHITE, 3);
 }
\ No newline at end of file
@@ -2,13 +2,19 @@
 #define LIFE_H
 
 #include <cstddef>
+#include <cstdint>
 #include <bitset>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "olcPixelGameEngine.h"
 #include "olcPGEX_TransformedView.h"
 
+#include "LifeEngine.h"
 #include "Cells.h"
+#include "HashLife.h"
+#include "Simulation.h"
 
 class Life : public olc::PixelGameEngine
 {
@@ -16,14 +22,37 @@ class Life : public olc::PixelGameEngine
 
   //olc::Renderable cursor;
 
-  Cells cells;
+  enum class EngineType
+  {
+    cells, bitCells, hashLife, sparse, events, lut
+  };
+
+  EngineType engineType{ EngineType::cells };
+  std::unique_ptr<LifeEngine> engine;
+  // Runs engine on its own thread, anything else only touches it through simulation.change
+  Simulation simulation{ engine };
+  int stepExponent{ 0 }; // HashLife advances 2^stepExponent generations per update
 
   bool paused{ true };
   bool drawMode{ 0 }; // Drawing or erasing
   int lifeChance{ 40 }; // life chance for randomize
+  int threadCount{ 0 }; // threads used to find next gen, 0 is one per core
+  bool torus{ false }; // whether the edges of the grid wrap around
+  bool autoPause{ false }; // pause once the population stops changing or the grid repeats
+  bool watchRepeats{ false }; // show how often the grid repeats itself, which J needs too
+  std::uint64_t settledGens{ 0 }; // generations the population has stayed the same for
+  std::uint64_t lastPopulation{ 0 };
+  std::uint64_t lastGeneration{ 0 };
+  static constexpr std::uint64_t settledAfter{ 100 };
+  std::uint64_t lastPeriod{ 0 }; // so a grid that repeats itself only pauses once
+  static constexpr std::uint64_t jumpGens{ 1000000 };
 
   float frameDuration{ .01f }; // how often cells update
-  float frameTimer{ .0f }; // time towards next cells update
+  olc::vi2d lastEdit{ -1, -1 }; // the cell the mouse last drew, so holding it still doesn't queue it again
+
+  // Fast-forward runs the engine flat out without drawing the grid, and a progress bar instead
+  bool fastForwarding{ false };
+  std::uint64_t fastForwardId{ 0 };
 
   int cR{ 255 }, cG{ 0 }, cB{ 255 }; // 255, 0, 255 is magenta
   int bgR{ 0 }, bgG{ 0 }, bgB{ 64 }; // 0, 0, 64 is very dark blue
@@ -45,7 +74,41 @@ class Life : public olc::PixelGameEngine
     olc::vi2d panPos{ 0, 0 };
     olc::vf2d mouseVel{ 0, 0 };
     olc::vi2d zoomMousePos{ 0, 0 };
-
+    // The cells the view is kept over, the grid or for engines without edges
+    // the grid and everything alive, see Snapshot::bounds
+    olc::vi2d worldTL{ 0, 0 };
+    olc::vi2d worldBR{ 0, 0 };
+
+    // The visible cells are drawn into a sprite, cellPixels pixels a cell, which goes
+    // to the screen as one decal. Each live cell is a copy of stamp.
+    // Zoomed out past a cell a pixel, it's a pixel for each block of a Density instead.
+    std::unique_ptr<olc::Sprite> gridSprite;
+    std::unique_ptr<olc::Decal> gridDecal;
+    std::unique_ptr<olc::Sprite> stamp;
+    // The rows of stamp that aren't empty, each repeated across the width of gridSprite,
+    // and which rows they are. A run of live cells is then one copy from each.
+    std::vector<olc::Pixel> stampPattern;
+    std::vector<int> patternRows;
+    int patternWidth{ 0 };
+    int cellPixels{ 0 };
+    olc::Pixel stampColour;
+    CellDrawType stampType{ CellDrawType::dots };
+    // What's in gridSprite, so it's only drawn again when something changes
+    std::uint64_t drawnSerial{ 0 };
+    olc::vi2d drawnTL{ 0, 0 }; // in blocks when drawnLevel isn't 0
+    int drawnLevel{ 0 };
+    bool drawnComplete{ false }; // whether the snapshot drawn had every visible cell, so it can be patched
+    olc::Pixel drawnColour; // of the blocks, the cells have the stamp's
+
+    void makeStamp(Life* const life, int pixels, olc::Pixel colour, CellDrawType type);
+    void makePattern();
+    // Makes gridSprite this size, true if it had to make a new one
+    bool fitSprite(const olc::vi2d& size);
+    // Draws the cells, or when the view hasn't moved only the tiles that changed since it last did
+    void drawCells(Life* const life, const Snapshot& shot, const olc::vi2d& tl, const olc::vi2d& br, olc::Pixel colour);
+    // Stamps the live cells from from to to into gridSprite, which starts at cell tl
+    void stampCells(const Snapshot& shot, const olc::vi2d& tl, const olc::vi2d& from, const olc::vi2d& to);
+    void drawDensity(const Snapshot& shot, const olc::vi2d& tl, const olc::vi2d& br, olc::Pixel colour);
     void smoothDecrease(float& value, float fElapsedTime, float factor = 0.1f);
   public:
     void initialize(Life const * const life, const olc::vf2d& scale)
@@ -62,8 +125,10 @@ class Life : public olc::PixelGameEngine
     {
       return tv;
     }
+    // The level of Density to show at this zoom, 0 when the cells are drawn one by one
+    int densityLevel() const;
     void update(Life const* const life, float fElapsedTime);
-    void draw(Life const* const life, float fElapsedTime);
+    void draw(Life* const life, float fElapsedTime);
   };
 
   Camera cam;
@@ -95,7 +160,14 @@ class Life : public olc::PixelGameEngine
       lifeChance = grid + 2,
       populaceControl = lifeChance + 2,
       speed = populaceControl + 2,
-      colour = speed + 2,
+      threads = speed + 2,
+      engine = threads + 2,
+      hashLifeStep,
+      rule,
+      edges,
+      repeats,
+      fastForward,
+      colour = fastForward + 2,
       backgroundColour,
       shape,
       instructions4 = shape + 3,
@@ -106,6 +178,9 @@ class Life : public olc::PixelGameEngine
       instructions6,
       instructions7,
       instructions8,
+      instructions12,
+      instructions13,
+      instructions14,
       end
     };
 
@@ -145,10 +220,38 @@ class Life : public olc::PixelGameEngine
 
     InputBox speedSlider{ Indexes::speed, {0, 20} };
 
+    InputBox threadsInput{ Indexes::threads, {600, 80} };
+
+    InputBox denseButton{ Indexes::engine, {200, 125} };
+    InputBox bitsButton{ Indexes::engine, {340, 100} };
+    InputBox hashLifeButton{ Indexes::engine, {455, 200} };
+    InputBox sparseButton{ Indexes::engine, {670, 150} };
+    InputBox eventsButton{ Indexes::engine, {835, 150} };
+    InputBox lutButton{ Indexes::engine, {1000, 90} };
+    InputBox stepInput{ Indexes::hashLifeStep, {600, 80} };
+
+    InputBox ruleInput{ Indexes::rule, {200, 400} };
+    std::string ruleText{ "B3/S23" };
+    bool ruleValid{ true };
+
+    InputBox deadEdgesButton{ Indexes::edges, {200, 125} };
+    InputBox wrapEdgesButton{ Indexes::edges, {340, 125} };
+
+    InputBox repeatsOffButton{ Indexes::repeats, {250, 100} };
+    InputBox repeatsWatchButton{ Indexes::repeats, {370, 150} };
+
+    int fastForwardGens{ 100000 };
+    int fastForwardSeconds{ 0 };
+    InputBox fastForwardGensInput{ Indexes::fastForward, {340, 250} };
+    InputBox fastForwardSecondsInput{ Indexes::fastForward, {680, 100} };
+    InputBox fastForwardButton{ Indexes::fastForward, {850, 100} };
+    olc::Pixel fastForwardSelection; // red if there's no grid or nothing to run to
+
     enum class Selection
     {
-      none, rows, columns, gridButton, lifeChance,
-      colR, colG, colB, bgR, bgG, bgB, randomButton, clearButton
+      none, rows, columns, gridButton, lifeChance, threads, step, rule,
+      colR, colG, colB, bgR, bgG, bgB, randomButton, clearButton,
+      fastForwardGens, fastForwardSeconds, fastForwardButton
     };
 
     Selection selected;
@@ -170,6 +273,17 @@ class Life : public olc::PixelGameEngine
       return rect;
     }
 
+    // Applies the rule being typed whenever it's a valid one
+    void typeRule(Life* const life, char c)
+    {
+      if (c) ruleText += c;
+      else if (!ruleText.empty()) ruleText.pop_back();
+
+      Rule rule;
+      ruleValid = Rule::parse(ruleText, rule);
+      if (ruleValid) life->simulation.change([&] { life->engine->setRule(rule); });
+    }
+
     void input(int keyInp, int& value, int limit = -1)
     {
       if (value < 0) value = 0;
@@ -221,6 +335,8 @@ class Life : public olc::PixelGameEngine
       dragginScrollbar = false;
     }
     bool isOpen() { return opened; }
+    // Letters typed into the rule aren't shortcuts
+    bool isTyping() { return opened && selected == Selection::rule; }
     void update(Life* const life, float fElapsedTime);
   };
 
@@ -230,8 +346,27 @@ class Life : public olc::PixelGameEngine
 
   void randomize();
 
+  // Starts a fast-forward of gens updates or seconds, whichever is first, 0 for no limit
+  void fastForward(std::uint64_t gens, float seconds);
+
+  // Draws how far a fast-forward has got
+  void drawFastForward(const Snapshot& shot);
+
+  static std::unique_ptr<LifeEngine> makeEngine(EngineType type);
+
+  // Switches engine, moving the current pattern over to the new one
+  void setEngine(EngineType type);
+
+  // The engine as HashLife if that's the one in use
+  HashLife* hashLife();
+
+  // The engine as Cells if that's the one in use, which keeps count of its cells
+  Cells* cells();
+  // Cells only hashes its grid while something looks at whether it repeats, it costs about a step
+  void hashIfWatched();
+
 public:
-  Life()
+  Life() :engine{ makeEngine(engineType) }
   {
     sAppName = "Conway's Game of Life";
   }
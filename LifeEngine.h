@@ -0,0 +1,292 @@
+#ifndef LIFEENGINE_H
+#define LIFEENGINE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "Rule.h"
+
+// A rectangle of cells, one bit each, used to move whole patterns between engines.
+// Rows are stored one after the other as 64 bit words and bit i of a row is column i,
+// the same layout BitCells uses, so engines that store bits can copy whole words.
+struct Bitmap
+{
+  Bitmap() {}
+  Bitmap(std::int64_t left, std::int64_t top, std::size_t width, std::size_t height)
+    :x{ left }, y{ top }, w{ width }, h{ height }, stride{ (width + 63) / 64 }, words(stride * height, 0)
+  {}
+
+  bool get(std::int64_t i, std::int64_t j) const
+  {
+    if (!inside(i, j)) return false;
+    const auto c = static_cast<std::size_t>(i - x);
+    return words[static_cast<std::size_t>(j - y) * stride + c / 64] >> (c % 64) & 1;
+  }
+
+  void set(std::int64_t i, std::int64_t j)
+  {
+    if (!inside(i, j)) return;
+    const auto c = static_cast<std::size_t>(i - x);
+    words[static_cast<std::size_t>(j - y) * stride + c / 64] |= std::uint64_t{ 1 } << (c % 64);
+  }
+
+  // The 64 cells starting at column i of row j, with the ones outside the bitmap dead
+  std::uint64_t read(std::int64_t i, std::int64_t j) const
+  {
+    if (j < y || j >= y + static_cast<std::int64_t>(h)) return 0;
+
+    const std::uint64_t* const row = words.data() + static_cast<std::size_t>(j - y) * stride;
+    const std::int64_t c = i - x;
+    const std::int64_t k = c >= 0 ? c / 64 : (c - 63) / 64;
+    const int shift = static_cast<int>(c - k * 64);
+
+    const auto wordAt = [&](std::int64_t n) -> std::uint64_t {
+      return n >= 0 && n < static_cast<std::int64_t>(stride) ? row[n] : 0;
+    };
+    if (shift == 0) return wordAt(k);
+    return wordAt(k) >> shift | wordAt(k + 1) << (64 - shift);
+  }
+
+  // Sets the cells of row j that are set in bits, bit 0 being column i.
+  // Cells outside the bitmap are ignored.
+  void write(std::int64_t i, std::int64_t j, std::uint64_t bits)
+  {
+    if (!bits || j < y || j >= y + static_cast<std::int64_t>(h)) return;
+
+    std::uint64_t* const row = words.data() + static_cast<std::size_t>(j - y) * stride;
+    const std::int64_t c = i - x;
+    const std::int64_t k = c >= 0 ? c / 64 : (c - 63) / 64;
+    const int shift = static_cast<int>(c - k * 64);
+
+    // The padding past the right edge must stay dead
+    if (static_cast<std::int64_t>(w) - c < 64)
+    {
+      const std::int64_t keep = static_cast<std::int64_t>(w) - c;
+      if (keep <= 0) return;
+      bits &= (std::uint64_t{ 1 } << keep) - 1;
+    }
+
+    if (k >= 0 && k < static_cast<std::int64_t>(stride)) row[k] |= bits << shift;
+    if (shift && k + 1 >= 0 && k + 1 < static_cast<std::int64_t>(stride)) row[k + 1] |= bits >> (64 - shift);
+  }
+
+  bool inside(std::int64_t i, std::int64_t j) const
+  {
+    return i >= x && j >= y && i < x + static_cast<std::int64_t>(w) && j < y + static_cast<std::int64_t>(h);
+  }
+
+  // Universe coordinates of the top left cell
+  std::int64_t x{ 0 };
+  std::int64_t y{ 0 };
+  std::size_t w{ 0 };
+  std::size_t h{ 0 };
+  std::size_t stride{ 0 }; // words per row
+  std::vector<std::uint64_t> words;
+};
+
+// Live cells counted in square blocks 2^level cells wide, for showing more cells than there are pixels.
+// Block bx, by holds columns bx << level to (bx + 1 << level) - 1 and the same rows.
+struct Density
+{
+  Density() {}
+  Density(std::int64_t left, std::int64_t top, std::size_t width, std::size_t height, int lvl)
+    :x{ left }, y{ top }, w{ width }, h{ height }, level{ lvl }, counts(width * height, 0)
+  {}
+
+  std::uint32_t get(std::int64_t bx, std::int64_t by) const
+  {
+    if (!inside(bx, by)) return 0;
+    return counts[static_cast<std::size_t>(by - y) * w + static_cast<std::size_t>(bx - x)];
+  }
+
+  void add(std::int64_t bx, std::int64_t by, std::uint32_t n)
+  {
+    if (!inside(bx, by)) return;
+    counts[static_cast<std::size_t>(by - y) * w + static_cast<std::size_t>(bx - x)] += n;
+  }
+
+  bool inside(std::int64_t bx, std::int64_t by) const
+  {
+    return bx >= x && by >= y && bx < x + static_cast<std::int64_t>(w) && by < y + static_cast<std::int64_t>(h);
+  }
+
+  // The block holding cell i, rounding down for cells left of or above 0
+  std::int64_t blockOf(std::int64_t i) const
+  {
+    const std::int64_t size = std::int64_t{ 1 } << level;
+    return i >= 0 ? i / size : (i - size + 1) / size;
+  }
+
+  // Blocks, not cells
+  std::int64_t x{ 0 };
+  std::int64_t y{ 0 };
+  std::size_t w{ 0 };
+  std::size_t h{ 0 };
+  int level{ 0 };
+  std::vector<std::uint32_t> counts;
+};
+
+// What Life needs from a simulation engine, so they can be swapped while running.
+// Coordinates are signed because some engines have no edges. Engines that do
+// have edges only hold cells from 0, 0 to width - 1, height - 1.
+class LifeEngine
+{
+public:
+  struct Box
+  {
+    std::int64_t left;
+    std::int64_t top;
+    std::int64_t right; // one past the last column
+    std::int64_t bottom; // one past the last row
+
+    bool empty() const { return left >= right || top >= bottom; }
+  };
+
+  virtual ~LifeEngine() {}
+
+  virtual void setCell(std::int64_t i, std::int64_t j) = 0;
+  virtual void unsetCell(std::int64_t i, std::int64_t j) = 0;
+  virtual bool isAlive(std::int64_t i, std::int64_t j) const = 0;
+
+  // Advances the universe by one update, which is a generation for every engine but HashLife
+  virtual void nextGen() = 0;
+
+  virtual void step(std::uint64_t updates)
+  {
+    while (updates--) nextGen();
+  }
+
+  // Calls f(i, j) for every live cell
+  virtual void forEachLive(const std::function<void(std::int64_t, std::int64_t)>& f) const = 0;
+
+  virtual std::uint64_t population() const
+  {
+    std::uint64_t n{ 0 };
+    forEachLive([&](std::int64_t, std::int64_t) { n++; });
+    return n;
+  }
+
+  // The smallest box holding every live cell, empty if nothing is alive
+  virtual Box boundingBox() const
+  {
+    Box box{ INT64_MAX, INT64_MAX, INT64_MIN, INT64_MIN };
+    forEachLive([&](std::int64_t i, std::int64_t j) {
+      if (i < box.left) box.left = i;
+      if (j < box.top) box.top = j;
+      if (i >= box.right) box.right = i + 1;
+      if (j >= box.bottom) box.bottom = j + 1;
+    });
+    if (box.empty()) box = { 0, 0, 0, 0 };
+    return box;
+  }
+
+  // Copies out the cells of a rectangle in one go
+  virtual Bitmap exportBitmap(std::int64_t left, std::int64_t top, std::size_t width, std::size_t height) const
+  {
+    Bitmap bitmap(left, top, width, height);
+    forEachLive([&](std::int64_t i, std::int64_t j) { bitmap.set(i, j); });
+    return bitmap;
+  }
+
+  // Counts the live cells of a rectangle of blocks, see Density.
+  // Goes through it as one bitmap, so it costs about as much as exporting it.
+  virtual Density exportDensity(std::int64_t left, std::int64_t top, std::size_t width, std::size_t height, int level) const
+  {
+    Density density(left, top, width, height, level);
+    const std::size_t size = std::size_t{ 1 } << level;
+    const Bitmap cells = exportBitmap(left * static_cast<std::int64_t>(size), top * static_cast<std::int64_t>(size),
+      width * size, height * size);
+
+    for (std::size_t j = 0; j < cells.h; j++)
+      for (std::size_t k = 0; k < cells.stride; k++)
+      {
+        // The word's cells go to the blocks they fall in, a whole word at once if a block is wider
+        std::uint64_t bits = cells.words[j * cells.stride + k];
+        for (std::size_t c = k * 64; bits; )
+        {
+          const std::size_t n = std::min<std::size_t>(64 - c % 64, size - c % size);
+          const std::uint64_t part = n == 64 ? bits : bits & ((std::uint64_t{ 1 } << n) - 1);
+          density.add(left + static_cast<std::int64_t>(c / size), top + static_cast<std::int64_t>(j / size),
+            static_cast<std::uint32_t>(popcount(part)));
+          bits = n == 64 ? 0 : bits >> n;
+          c += n;
+        }
+      }
+    return density;
+  }
+
+  // Sets the bit of every 64x64 tile that may have changed since the last call in tiles,
+  // a Bitmap with a bit a tile, tile 0, 0 starting at cell 0, 0.
+  // Engines that don't keep track of it say they all did.
+  virtual void takeChanges(Bitmap& tiles)
+  {
+    for (std::size_t j = 0; j < tiles.h; j++)
+      for (std::size_t i = 0; i < tiles.w; i += 64)
+        tiles.write(tiles.x + static_cast<std::int64_t>(i), tiles.y + static_cast<std::int64_t>(j), ~std::uint64_t{ 0 });
+  }
+
+  // Replaces everything with the cells of the bitmap
+  virtual void importBitmap(const Bitmap& bitmap)
+  {
+    clear();
+    for (std::size_t j = 0; j < bitmap.h; j++)
+      for (std::size_t i = 0; i < bitmap.w; i++)
+        if (bitmap.get(bitmap.x + i, bitmap.y + j)) setCell(bitmap.x + i, bitmap.y + j);
+  }
+
+  // Rules with B0 can't be run, Rule::parse refuses them
+  virtual void setRule(const Rule& r)
+  {
+    rule = r;
+  }
+
+  const Rule& getRule() const
+  {
+    return rule;
+  }
+
+  // Engines that can't use more than one thread ignore this
+  virtual void setThreadCount(std::size_t) {}
+
+  // Whether the grid wraps around. Only some engines with edges can.
+  virtual void setTorus(bool) {}
+  virtual bool isTorus() const { return false; }
+
+  // Engines without edges hold cells anywhere, their width and height are only
+  // the box a new grid is randomised in and first shown
+  virtual bool hasEdges() const { return true; }
+
+  virtual void setDimensions(std::size_t i, std::size_t j) = 0;
+  virtual std::size_t getWidth() const = 0;
+  virtual std::size_t getHeight() const = 0;
+  virtual void destroy() = 0;
+  virtual void clear() = 0;
+  virtual bool exist() const = 0;
+
+protected:
+  Rule rule;
+
+  static int popcount(std::uint64_t bits)
+  {
+    bits -= bits >> 1 & 0x5555555555555555;
+    bits = (bits & 0x3333333333333333) + (bits >> 2 & 0x3333333333333333);
+    bits = (bits + (bits >> 4)) & 0x0F0F0F0F0F0F0F0F;
+    return static_cast<int>(bits * 0x0101010101010101 >> 56);
+  }
+
+  // Calls f(i) for every set bit i of bits
+  template <typename F>
+  static void forEachBit(std::uint64_t bits, F f)
+  {
+    while (bits)
+    {
+      f(popcount((bits & (~bits + 1)) - 1));
+      bits &= bits - 1;
+    }
+  }
+};
+
+#endif
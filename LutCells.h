@@ -0,0 +1,303 @@
+#ifndef LUTCELLS_H
+#define LUTCELLS_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "LifeEngine.h"
+#include "Pages.h"
+#include "ThreadPool.h"
+
+// Engine that finds the next generation with a lookup table instead of adding up neighbours,
+// so it's quick on CPUs without SIMD and in the web build.
+// The grid is stored as 2x2 blocks of cells, one block to a byte in its low four bits.
+// Four blocks next to each other make a 4x4 square whose middle 2x2 next generation
+// is one entry of a 65536 entry table, worked out from the rule whenever it changes.
+// That middle is a block one cell down and right of the four, so the blocks of odd
+// generations sit one cell off those of even ones and the two take turns.
+struct LutCells : public LifeEngine
+{
+  LutCells() :exists{ false }, w{ 0 }, h{ 0 }, blocks{ nullptr }, blocks2{ nullptr }, table(1 << 16)
+  {
+    makeTable();
+  }
+  LutCells(std::size_t i, std::size_t j) :LutCells()
+  {
+    setDimensions(i, j);
+  }
+
+  ~LutCells()
+  {
+    destroy();
+  }
+
+  void setCell(std::int64_t i, std::int64_t j) override
+  {
+    blocks[index(i, j)] |= bit(i, j);
+  }
+
+  void unsetCell(std::int64_t i, std::int64_t j) override
+  {
+    blocks[index(i, j)] &= ~bit(i, j);
+  }
+
+  bool isAlive(std::int64_t i, std::int64_t j) const override
+  {
+    return blocks[index(i, j)] & bit(i, j);
+  }
+
+  void nextGen() override
+  {
+    if (!exists) return;
+    if (!pool) pool = std::make_unique<ThreadPool>(threads);
+
+    // Even generations: block b covers cells 2b - 2 and 2b - 1, so block 0 and the last are dead.
+    // Odd generations: block b covers cells 2b - 1 and 2b.
+    // From even to odd a block is the middle of itself and the ones right and below it,
+    // from odd to even of itself and the ones left and above it.
+    const bool toOdd = !odd;
+    const std::size_t rows = toOdd ? h / 2 + 1 : (h + 1) / 2;
+    const std::size_t first = toOdd ? 0 : 1;
+    const std::size_t columns = toOdd ? w / 2 + 1 : (w + 1) / 2;
+
+    // The cells of an odd block past the left or top edge, or any past the right or bottom,
+    // have to be kept dead. Bits 0 and 2 are the left column, 0 and 1 the top row.
+    const unsigned char left = toOdd ? 0x0A : 0x0F, top = toOdd ? 0x0C : 0x0F;
+    const unsigned char right = (w % 2 == 0) == toOdd ? 0x05 : 0x0F;
+    const unsigned char bottom = (h % 2 == 0) == toOdd ? 0x03 : 0x0F;
+
+    std::size_t jobs = pool->size() * 4;
+    if (jobs > rows) jobs = rows;
+
+    const unsigned char* const lut = table.data();
+    pool->run(jobs, [&](std::size_t job) {
+      for (std::size_t y = first + rows * job / jobs; y < first + rows * (job + 1) / jobs; y++)
+      {
+        // The 2x2 blocks that make up each 4x4 square
+        const unsigned char* const above = blocks + (y - first) * stride;
+        const unsigned char* const below = above + stride;
+        unsigned char* const next = blocks2 + y * stride;
+
+        for (std::size_t x = first; x < first + columns; x++)
+        {
+          const std::size_t k = x - first;
+          next[x] = lut[above[k] | above[k + 1] << 4 | below[k] << 8 | below[k + 1] << 12];
+        }
+
+        next[first] &= left;
+        next[first + columns - 1] &= right;
+        if (y == first)
+          for (std::size_t x = first; x < first + columns; x++) next[x] &= top;
+        if (y == first + rows - 1)
+          for (std::size_t x = first; x < first + columns; x++) next[x] &= bottom;
+      }
+    });
+
+    auto temp = blocks;
+    blocks = blocks2;
+    blocks2 = temp;
+    odd = toOdd;
+  }
+
+  void setThreadCount(std::size_t n) override
+  {
+    threads = n;
+    if (pool) pool->resize(n);
+  }
+
+  void setRule(const Rule& r) override
+  {
+    LifeEngine::setRule(r);
+    makeTable();
+  }
+
+  void setDimensions(std::size_t i, std::size_t j) override
+  {
+    destroy();
+    w = i;
+    h = j;
+
+    // A dead block all round both ways of laying them out
+    stride = (i + 1) / 2 + 2;
+    blocks = Pages::allocate(bufferBytes());
+    blocks2 = Pages::allocate(bufferBytes());
+    if (!blocks || !blocks2)
+    {
+      Pages::release(blocks, bufferBytes());
+      Pages::release(blocks2, bufferBytes());
+      blocks = blocks2 = nullptr;
+      throw std::bad_alloc();
+    }
+    exists = true;
+    clear();
+  }
+
+  std::size_t getWidth() const override
+  {
+    return w;
+  }
+
+  std::size_t getHeight() const override
+  {
+    return h;
+  }
+
+  void destroy() override
+  {
+    if (!exists) return;
+
+    Pages::release(blocks, bufferBytes());
+    Pages::release(blocks2, bufferBytes());
+    blocks = blocks2 = nullptr;
+    exists = false;
+  }
+
+  void clear() override
+  {
+    if (!exists) return;
+
+    Pages::zero(blocks, bufferBytes());
+    Pages::zero(blocks2, bufferBytes());
+    odd = false;
+  }
+
+  bool exist() const override
+  {
+    return exists;
+  }
+
+  void forEachLive(const std::function<void(std::int64_t, std::int64_t)>& f) const override
+  {
+    if (!exists) return;
+
+    for (std::size_t j = 0; j < h; j++)
+      for (std::size_t i = 0; i < w; i++)
+        if (isAlive(i, j)) f(i, j);
+  }
+
+  std::uint64_t population() const override
+  {
+    if (!exists) return 0;
+
+    // Cells past the edges are always dead so every block can be counted
+    std::uint64_t n{ 0 };
+    for (std::size_t k = 0; k < bufferBytes(); k++) n += popcount(blocks[k]);
+    return n;
+  }
+
+  // Only the blocks in the rectangle are looked at, two cells of a row at a time
+  Bitmap exportBitmap(std::int64_t left, std::int64_t top, std::size_t width, std::size_t height) const override
+  {
+    Bitmap bitmap(left, top, width, height);
+    if (!exists) return bitmap;
+
+    const std::int64_t x0 = std::max<std::int64_t>(left, 0), y0 = std::max<std::int64_t>(top, 0);
+    const std::int64_t x1 = std::min<std::int64_t>(left + width, w), y1 = std::min<std::int64_t>(top + height, h);
+    if (x1 <= x0 || y1 <= y0) return bitmap;
+
+    const std::int64_t o = odd ? 1 : 2;
+    for (std::int64_t j = y0; j < y1; j++)
+    {
+      const unsigned char* const row = blocks + static_cast<std::size_t>((j + o) / 2) * stride;
+      const int shift = static_cast<int>((j + o) % 2 * 2);
+      std::uint64_t* const out = bitmap.words.data() + static_cast<std::size_t>(j - top) * bitmap.stride;
+      const auto set = [&](std::int64_t i) {
+        const auto c = static_cast<std::size_t>(i - left);
+        out[c / 64] |= std::uint64_t{ 1 } << (c % 64);
+      };
+
+      for (std::int64_t b = (x0 + o) / 2; b <= (x1 - 1 + o) / 2; b++)
+      {
+        const unsigned int pair = row[b] >> shift & 0x03;
+        if (!pair) continue;
+
+        // The block's left cell, which can be just outside the rectangle
+        const std::int64_t i = 2 * b - o;
+        if ((pair & 0x01) && i >= x0) set(i);
+        if ((pair & 0x02) && i + 1 < x1) set(i + 1);
+      }
+    }
+    return bitmap;
+  }
+
+  // Every pair of bits of a word is the row of a block, in the even generations' layout
+  void importBitmap(const Bitmap& bitmap) override
+  {
+    clear();
+    if (!exists) return;
+
+    for (std::size_t j = 0; j < h; j++)
+    {
+      unsigned char* const row = blocks + (j + 2) / 2 * stride;
+      const int shift = static_cast<int>(j % 2 * 2);
+      for (std::size_t i = 0; i < w; i += 64)
+      {
+        std::uint64_t bits = bitmap.read(static_cast<std::int64_t>(i), static_cast<std::int64_t>(j));
+        if (w - i < 64) bits &= (std::uint64_t{ 1 } << (w - i)) - 1;
+        for (std::size_t k = 0; bits; k += 2, bits >>= 2)
+          if (bits & 0x03) row[(i + k) / 2 + 1] |= static_cast<unsigned char>((bits & 0x03) << shift);
+      }
+    }
+  }
+
+private:
+  // Bit 0 of the index is the top left cell of the 4x4 square, bit 15 the bottom right,
+  // four bits to a block: top left, top right, bottom left and bottom right of the square
+  void makeTable()
+  {
+    const auto cell = [](unsigned int square, int x, int y) -> bool {
+      const int block = (y / 2) * 2 + x / 2;
+      return square >> (block * 4 + (y % 2) * 2 + x % 2) & 1;
+    };
+
+    for (unsigned int square = 0; square < table.size(); square++)
+    {
+      unsigned char middle{ 0 };
+      for (int y = 1; y <= 2; y++)
+        for (int x = 1; x <= 2; x++)
+        {
+          int neighbours{ 0 };
+          for (int dy = -1; dy <= 1; dy++)
+            for (int dx = -1; dx <= 1; dx++)
+              if (dx || dy) neighbours += cell(square, x + dx, y + dy);
+          if (rule.lives(cell(square, x, y), neighbours)) middle |= 1 << ((y - 1) * 2 + x - 1);
+        }
+      table[square] = middle;
+    }
+  }
+
+  // The block a cell is in and its bit in it, which depend on which way round the blocks are
+  std::size_t index(std::int64_t i, std::int64_t j) const
+  {
+    const std::size_t o = odd ? 1 : 2;
+    return (static_cast<std::size_t>(j) + o) / 2 * stride + (static_cast<std::size_t>(i) + o) / 2;
+  }
+
+  unsigned char bit(std::int64_t i, std::int64_t j) const
+  {
+    const std::size_t o = odd ? 1 : 2;
+    return static_cast<unsigned char>(1 << ((static_cast<std::size_t>(j) + o) % 2 * 2 + (static_cast<std::size_t>(i) + o) % 2));
+  }
+
+  std::size_t bufferBytes() const
+  {
+    return stride * ((h + 1) / 2 + 2);
+  }
+
+  bool exists;
+  std::size_t w;
+  std::size_t h;
+  std::size_t stride{ 0 }; // blocks per row
+  unsigned char* blocks;
+  unsigned char* blocks2;
+  bool odd{ false }; // the blocks are laid out the odd generations' way
+  std::vector<unsigned char> table;
+  std::size_t threads{ 0 };
+  std::unique_ptr<ThreadPool> pool;
+};
+
+#endif
@@ -0,0 +1,238 @@
+#ifndef PAGES_H
+#define PAGES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#if defined(_WIN32)
+#define PAGES_WINDOWS
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif (defined(__unix__) && !defined(__EMSCRIPTEN__)) || defined(__APPLE__)
+#define PAGES_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Memory for the big cell arrays straight from the OS instead of the heap.
+// Fresh pages from the OS already read as zero and are only backed by memory
+// once they're touched, so a huge grid costs nothing until cells are drawn on it
+// and clearing it gives the pages back instead of writing zeros over them.
+// On Linux the blocks are lined up on 2 MiB so they can use huge pages,
+// which saves a lot of TLB misses when a grid spans gigabytes.
+// Anything small, or on platforms without mmap, comes from calloc.
+//
+// Grids bigger than memory can live in a file mapped the same way,
+// where the OS pages them in and writes them back as they're used.
+namespace Pages
+{
+  constexpr std::size_t hugePage{ std::size_t{ 1 } << 21 };
+
+  // Smaller blocks aren't worth a system call
+  constexpr std::size_t threshold{ std::size_t{ 1 } << 20 };
+
+  // What's actually mapped for a block of bytes
+  inline std::size_t mappedSize(std::size_t bytes)
+  {
+    return (bytes + hugePage - 1) / hugePage * hugePage;
+  }
+
+  // Zeroed memory, nullptr if there isn't enough
+  inline unsigned char* allocate(std::size_t bytes)
+  {
+    if (bytes < threshold) return static_cast<unsigned char*>(std::calloc(bytes ? bytes : 1, 1));
+
+    const std::size_t size = mappedSize(bytes);
+#if defined(PAGES_WINDOWS)
+    return static_cast<unsigned char*>(VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+#elif defined(PAGES_MMAP)
+#if defined(MAP_HUGETLB)
+    // Explicit huge pages only work if the admin has reserved some, so this usually fails
+    void* explicitHuge = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (explicitHuge != MAP_FAILED) return static_cast<unsigned char*>(explicitHuge);
+#endif
+
+    // Map a huge page extra and trim it off so the block starts on a huge page boundary
+    void* const mapped = mmap(nullptr, size + hugePage, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) return nullptr;
+
+    unsigned char* const start = static_cast<unsigned char*>(mapped);
+    const std::size_t offset = (hugePage - reinterpret_cast<std::uintptr_t>(start) % hugePage) % hugePage;
+    if (offset) munmap(start, offset);
+    munmap(start + offset + size, hugePage - offset);
+
+#if defined(MADV_HUGEPAGE)
+    madvise(start + offset, size, MADV_HUGEPAGE);
+#endif
+    return start + offset;
+#else
+    return static_cast<unsigned char*>(std::calloc(bytes, 1));
+#endif
+  }
+
+  // bytes has to be the same as it was allocated with
+  inline void release(unsigned char* p, std::size_t bytes)
+  {
+    if (!p) return;
+
+    if (bytes < threshold)
+    {
+      std::free(p);
+      return;
+    }
+#if defined(PAGES_WINDOWS)
+    VirtualFree(p, 0, MEM_RELEASE);
+#elif defined(PAGES_MMAP)
+    munmap(p, mappedSize(bytes));
+#else
+    std::free(p);
+#endif
+  }
+
+  // Sets a block back to zero by handing its pages back to the OS,
+  // which gives out zeroed ones the next time they're touched
+  inline void zero(unsigned char* p, std::size_t bytes)
+  {
+    if (bytes < threshold)
+    {
+      std::memset(p, 0, bytes);
+      return;
+    }
+#if defined(PAGES_WINDOWS)
+    const std::size_t size = mappedSize(bytes);
+    if (!VirtualFree(p, size, MEM_DECOMMIT) || !VirtualAlloc(p, size, MEM_COMMIT, PAGE_READWRITE))
+      std::memset(p, 0, bytes);
+#elif defined(PAGES_MMAP) && defined(MADV_DONTNEED) && !defined(__APPLE__)
+    // Private anonymous pages read as zero again after this, explicit huge pages need a newer kernel
+    if (madvise(p, mappedSize(bytes), MADV_DONTNEED)) std::memset(p, 0, bytes);
+#else
+    std::memset(p, 0, bytes);
+#endif
+  }
+
+  // Maps the whole of a file into memory for reading and writing, shared with the file
+  // so everything written ends up in it. A missing file is created, or an existing one
+  // emptied if fresh, and a short one is grown with zeros, which on most file systems
+  // doesn't take any disk until written. Returns nullptr if that can't be done, as on the web.
+  inline unsigned char* mapFile(const std::string& path, std::size_t bytes, bool fresh)
+  {
+#if defined(PAGES_WINDOWS)
+    const HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+      fresh ? CREATE_ALWAYS : OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return nullptr;
+
+    LARGE_INTEGER size;
+    size.QuadPart = static_cast<LONGLONG>(bytes);
+    const HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, size.HighPart, size.LowPart, nullptr);
+    void* const view = mapping ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, bytes) : nullptr;
+
+    // The view keeps the file open by itself
+    if (mapping) CloseHandle(mapping);
+    CloseHandle(file);
+    return static_cast<unsigned char*>(view);
+#elif defined(PAGES_MMAP)
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | (fresh ? O_TRUNC : 0), 0644);
+    if (fd < 0) return nullptr;
+
+    struct stat info;
+    if (fstat(fd, &info) || (static_cast<std::size_t>(info.st_size) < bytes && ftruncate(fd, static_cast<off_t>(bytes))))
+    {
+      close(fd);
+      return nullptr;
+    }
+
+    void* const mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return mapped == MAP_FAILED ? nullptr : static_cast<unsigned char*>(mapped);
+#else
+    (void)path;
+    (void)bytes;
+    (void)fresh;
+    return nullptr;
+#endif
+  }
+
+  // Size of a file in bytes, 0 if it doesn't exist
+  inline std::size_t fileSize(const std::string& path)
+  {
+#if defined(PAGES_WINDOWS)
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &data)) return 0;
+    return static_cast<std::size_t>(data.nFileSizeHigh) << 32 | data.nFileSizeLow;
+#elif defined(PAGES_MMAP)
+    struct stat info;
+    return stat(path.c_str(), &info) ? 0 : static_cast<std::size_t>(info.st_size);
+#else
+    (void)path;
+    return 0;
+#endif
+  }
+
+  inline void unmapFile(unsigned char* p, std::size_t bytes)
+  {
+    if (!p) return;
+#if defined(PAGES_WINDOWS)
+    (void)bytes;
+    UnmapViewOfFile(p);
+#elif defined(PAGES_MMAP)
+    munmap(p, bytes);
+#endif
+  }
+
+  // Waits until what was written to part of a mapped file is on disk
+  inline void flush(unsigned char* p, std::size_t bytes)
+  {
+#if defined(PAGES_WINDOWS)
+    FlushViewOfFile(p, bytes);
+#elif defined(PAGES_MMAP)
+    msync(p, bytes, MS_SYNC);
+#endif
+  }
+
+  // Zeroes part of a mapped file. Where the file system can, the range becomes a hole
+  // in the file, otherwise it's written over. p has to be on a page boundary.
+  inline void zeroFile(unsigned char* p, std::size_t bytes)
+  {
+#if defined(PAGES_MMAP) && defined(MADV_REMOVE)
+    if (!madvise(p, bytes, MADV_REMOVE)) return;
+#endif
+    std::memset(p, 0, bytes);
+  }
+
+  // Hints for sweeping through a mapped file in order: read ahead the part that's
+  // about to be used and let go of the part that's done, so the sweep doesn't
+  // push everything else out of memory. Only hints, nothing changes if they're ignored.
+  inline void willNeed(unsigned char* p, std::size_t bytes)
+  {
+#if defined(PAGES_MMAP) && defined(MADV_WILLNEED)
+    const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    const std::size_t skip = reinterpret_cast<std::uintptr_t>(p) % page;
+    madvise(p - skip, bytes + skip, MADV_WILLNEED);
+#else
+    (void)p;
+    (void)bytes;
+#endif
+  }
+
+  inline void done(unsigned char* p, std::size_t bytes)
+  {
+#if defined(PAGES_MMAP) && defined(MADV_COLD)
+    // Whole pages only, the ones at either end may still be in use
+    const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    const std::size_t skip = (page - reinterpret_cast<std::uintptr_t>(p) % page) % page;
+    if (bytes > skip + page) madvise(p + skip, (bytes - skip) / page * page, MADV_COLD);
+#else
+    (void)p;
+    (void)bytes;
+#endif
+  }
+}
+
+#endif
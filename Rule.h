@@ -0,0 +1,105 @@
+#ifndef RULE_H
+#define RULE_H
+
+#include <cstdint>
+#include <string>
+
+// A Life-like rule: which neighbour counts give birth to a dead cell and
+// which let a live one survive, written as a rulestring like B3/S23.
+struct Rule
+{
+  constexpr Rule() :birth{ 1 << 3 }, survival{ 1 << 2 | 1 << 3 } {}
+  constexpr Rule(std::uint16_t b, std::uint16_t s) :birth{ b }, survival{ s } {}
+
+  // Bit n of transitions is whether a cell lives next generation, where n is
+  // alive | neighbours << 1, the same as a Cells byte. That's 18 entries,
+  // a dead and a live one for every neighbour count from 0 to 8.
+  constexpr std::uint32_t transitions() const
+  {
+    std::uint32_t t{ 0 };
+    for (int n = 0; n <= 8; n++)
+    {
+      if (birth >> n & 1) t |= std::uint32_t{ 1 } << (n << 1);
+      if (survival >> n & 1) t |= std::uint32_t{ 1 } << (n << 1 | 1);
+    }
+    return t;
+  }
+
+  constexpr bool lives(bool alive, int neighbours) const
+  {
+    return (alive ? survival : birth) >> neighbours & 1;
+  }
+
+  constexpr bool operator==(const Rule& o) const
+  {
+    return birth == o.birth && survival == o.survival;
+  }
+
+  constexpr bool operator!=(const Rule& o) const
+  {
+    return !(*this == o);
+  }
+
+  // Reads rulestrings like B36/S23, s23/b36 or B3S23.
+  // Returns false and leaves rule alone if the text isn't a rule.
+  // B0 is refused: empty space would come alive every generation,
+  // which no engine can do with a universe of dead cells around the grid.
+  static bool parse(const std::string& text, Rule& rule)
+  {
+    std::uint16_t b{ 0 }, s{ 0 };
+    std::uint16_t* digits{ nullptr };
+    bool seenB{ false }, seenS{ false };
+
+    for (const char c : text)
+    {
+      if (c == 'B' || c == 'b')
+      {
+        if (seenB) return false;
+        seenB = true;
+        digits = &b;
+      }
+      else if (c == 'S' || c == 's')
+      {
+        if (seenS) return false;
+        seenS = true;
+        digits = &s;
+      }
+      else if (c >= '0' && c <= '8')
+      {
+        if (!digits) return false;
+        *digits |= 1 << (c - '0');
+      }
+      else if (c != '/' && c != ' ') return false;
+    }
+
+    if (!seenB || !seenS || b & 1) return false;
+
+    rule = { b, s };
+    return true;
+  }
+
+  std::string toString() const
+  {
+    std::string text{ "B" };
+    for (int n = 0; n <= 8; n++)
+      if (birth >> n & 1) text += static_cast<char>('0' + n);
+    text += "/S";
+    for (int n = 0; n <= 8; n++)
+      if (survival >> n & 1) text += static_cast<char>('0' + n);
+    return text;
+  }
+
+  std::uint16_t birth; // bit n is set if n neighbours give birth
+  std::uint16_t survival; // bit n is set if a cell with n neighbours survives
+};
+
+// Rules the kernels have their own code for
+namespace Rules
+{
+  constexpr Rule conway{ 1 << 3, 1 << 2 | 1 << 3 };
+  constexpr Rule highLife{ 1 << 3 | 1 << 6, 1 << 2 | 1 << 3 };
+  constexpr Rule dayAndNight{ 1 << 3 | 1 << 6 | 1 << 7 | 1 << 8, 1 << 3 | 1 << 4 | 1 << 6 | 1 << 7 | 1 << 8 };
+  constexpr Rule seeds{ 1 << 2, 0 };
+}
+
+#endif
@@ -0,0 +1,463 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Cells.h"
+#include "HashLife.h"
+#include "LifeEngine.h"
+#include "TripleBuffer.h"
+
+// What the simulation shows the rest of the app: the cells around the view
+// after the last generation it ran, and the numbers for the HUD
+struct Snapshot
+{
+  Bitmap cells;
+  Density density; // instead of cells when the view is zoomed out past one cell a pixel
+  std::uint64_t serial{ 0 }; // one more than the snapshot published before it
+  // A bit for every 64x64 tile of the grid any cell of which may have changed since the
+  // snapshot numbered changedSince, so the frame can patch what it drew of that one.
+  // 0 if they aren't known.
+  Bitmap changed;
+  std::uint64_t changedSince{ 0 };
+  std::uint64_t generation{ 0 }; // Cells and HashLife count their own, the rest are updates run
+  // Where there can be live cells: the grid, or for engines without edges
+  // the grid and the box around everything alive
+  LifeEngine::Box bounds{ 0, 0, 0, 0 };
+
+  // Only Cells keeps these
+  bool counted{ false };
+  std::uint64_t population{ 0 };
+  std::uint64_t births{ 0 };
+  std::uint64_t deaths{ 0 };
+  std::uint64_t period{ 0 };
+
+  // The last fast-forward started and how far it's got
+  std::uint64_t fastForward{ 0 };
+  bool fastForwarding{ false };
+  std::uint64_t fastForwardDone{ 0 };
+  std::uint64_t fastForwardTotal{ 0 };
+  float fastForwardElapsed{ 0.0f };
+  float fastForwardBudget{ 0.0f };
+};
+
+// Runs the engine on a thread of its own, so a slow generation doesn't hold up input and
+// drawing, and a slow frame doesn't hold up the generations.
+// After every batch of generations the cells around the view are published as a Snapshot
+// through a triple buffer, which the frame picks the newest of without waiting.
+// Cells drawn with the mouse are queued and set between generations. Anything else that
+// changes the engine goes through change, which waits for the generation being run.
+// In a web build without threads the frame runs it instead, by calling poll.
+class Simulation
+{
+  using Clock = std::chrono::steady_clock;
+
+  struct Edit
+  {
+    std::int64_t i;
+    std::int64_t j;
+    bool alive;
+  };
+
+  // Runs until it's done total updates or budget seconds are up, whichever is first, 0 for no limit
+  struct FastForward
+  {
+    std::uint64_t id{ 0 };
+    bool active{ false };
+    std::uint64_t done{ 0 };
+    std::uint64_t total{ 0 };
+    float budget{ 0.0f };
+    float elapsed{ 0.0f };
+  };
+
+  // A batch never runs more updates than this, so a snapshot still comes out regularly
+  static constexpr std::uint64_t maxBatch{ 64 };
+  // The tiles changed before each of the last few snapshots, the frame has to
+  // have drawn one of them to get the changes since then
+  static constexpr std::size_t changesKept{ 16 };
+  static constexpr float fastForwardSlice{ .1f }; // seconds between snapshots of a fast-forward
+
+  std::unique_ptr<LifeEngine>& engine;
+  std::mutex engineMutex; // held while the engine is stepped or changed
+
+  // What the frame asks for, under stateMutex
+  std::mutex stateMutex;
+  std::condition_variable wake;
+  bool quitting{ false };
+  bool running{ false };
+  double interval{ .01 }; // seconds between updates
+  Clock::time_point lastUpdate;
+  std::vector<Edit> edits;
+  bool publishWanted{ true };
+  std::int64_t view[4]{}; // left, top, right and bottom of what the frame shows
+  int viewLevel{ 0 }; // the level of density it wants, 0 for cells
+  std::int64_t shown[4]{}; // the part of the grid in the last snapshot
+  int shownLevel{ 0 };
+  FastForward asked;
+  std::atomic<bool> stopAsked{ false };
+
+  // Only touched by whichever thread runs the engine
+  std::vector<Edit> applying;
+  FastForward fastForwarding;
+  std::uint64_t updates{ 0 };
+  std::uint64_t published{ 0 };
+  std::vector<Bitmap> changes = std::vector<Bitmap>(changesKept); // by serial, round and round
+  std::atomic<std::uint64_t> drawnSerial{ 0 }; // the last snapshot the frame said it drew
+
+  TripleBuffer<Snapshot> snapshots;
+  std::thread thread;
+
+  void run()
+  {
+    std::unique_lock<std::mutex> lock(stateMutex);
+    while (!quitting)
+    {
+      if (ready()) round(lock);
+      else if (running) wake.wait_until(lock, lastUpdate + step());
+      else wake.wait(lock);
+    }
+  }
+
+  Clock::duration step() const
+  {
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(interval));
+  }
+
+  bool ready() const
+  {
+    return !edits.empty() || publishWanted || asked.id != fastForwarding.id || fastForwarding.active
+      || (running && Clock::now() >= lastUpdate + step());
+  }
+
+  // Takes what the frame asked for, then runs it with the state unlocked
+  // so the frame never waits for a generation
+  void round(std::unique_lock<std::mutex>& lock)
+  {
+    applying.clear();
+    applying.swap(edits);
+    bool publish = publishWanted || !applying.empty();
+    publishWanted = false;
+
+    if (asked.id != fastForwarding.id)
+    {
+      fastForwarding = asked;
+      fastForwarding.active = true;
+      stopAsked = false;
+    }
+
+    // Generations that are due, like frames of a game. Too far behind to catch up, carry on from now.
+    std::uint64_t gens{ 0 };
+    const auto now = Clock::now();
+    if (running && !fastForwarding.active)
+    {
+      const auto due = static_cast<std::uint64_t>(std::chrono::duration<double>(now - lastUpdate).count() / interval);
+      gens = std::min(due, maxBatch);
+      lastUpdate = due > maxBatch ? now : lastUpdate + step() * static_cast<Clock::rep>(gens);
+    }
+
+    const std::int64_t width = view[2] - view[0], height = view[3] - view[1];
+    std::int64_t region[4]{ view[0] - width / 4, view[1] - height / 4, view[2] + width / 4, view[3] + height / 4 };
+    const int level = viewLevel;
+    lock.unlock();
+
+    {
+      std::lock_guard<std::mutex> engineLock(engineMutex);
+      for (const auto& e : applying)
+      {
+        if (e.alive) engine->setCell(e.i, e.j);
+        else engine->unsetCell(e.i, e.j);
+      }
+
+      if (fastForwarding.active)
+      {
+        runFastForward();
+        publish = true;
+      }
+      else if (gens)
+      {
+        engine->step(gens);
+        updates += gens;
+        publish = true;
+      }
+
+      if (publish)
+      {
+        const LifeEngine::Box box = bounds();
+        region[0] = std::max(region[0], box.left);
+        region[1] = std::max(region[1], box.top);
+        region[2] = std::min(region[2], box.right);
+        region[3] = std::min(region[3], box.bottom);
+        snapshots.back().bounds = box;
+        fill(snapshots.back(), region, level);
+        snapshots.back().serial = ++published;
+        addChanges(snapshots.back());
+        snapshots.publish();
+      }
+    }
+
+    lock.lock();
+    if (publish)
+    {
+      std::copy(region, region + 4, shown);
+      shownLevel = level;
+    }
+  }
+
+  // A slice of a fast-forward, with the updates run at once doubling until it's used up,
+  // so a small grid doesn't pay for a call each and a big one doesn't go far past it
+  void runFastForward()
+  {
+    FastForward& f = fastForwarding;
+    Cells* const cells = dynamic_cast<Cells*>(engine.get());
+    const auto start = Clock::now();
+    float slice{ 0.0f };
+
+    for (std::uint64_t chunk = 1; ; chunk *= 2)
+    {
+      std::uint64_t gens = f.total && chunk > f.total - f.done ? f.total - f.done : chunk;
+      // Once Cells knows its grid repeats itself the rest of the way is a few generations
+      if (f.total && cells && cells->period())
+      {
+        gens = f.total - f.done;
+        cells->skip(gens);
+      }
+      else engine->step(gens);
+      f.done += gens;
+      updates += gens;
+
+      slice = std::chrono::duration<float>(Clock::now() - start).count();
+      if ((f.total && f.done == f.total) || slice >= fastForwardSlice || stopAsked
+        || (f.budget > 0.0f && f.elapsed + slice >= f.budget))
+        break;
+    }
+    f.elapsed += slice;
+
+    if ((f.total && f.done == f.total) || stopAsked || (f.budget > 0.0f && f.elapsed >= f.budget))
+      f.active = false;
+  }
+
+  // See Snapshot::bounds
+  LifeEngine::Box bounds() const
+  {
+    LifeEngine::Box box{ 0, 0, static_cast<std::int64_t>(engine->getWidth()), static_cast<std::int64_t>(engine->getHeight()) };
+    if (engine->hasEdges()) return box;
+
+    const LifeEngine::Box live = engine->boundingBox();
+    if (live.empty()) return box;
+    return { std::min(box.left, live.left), std::min(box.top, live.top),
+      std::max(box.right, live.right), std::max(box.bottom, live.bottom) };
+  }
+
+  // Takes the tiles the engine changed since the last snapshot, and gives s the ones
+  // changed since the last one the frame drew if it's recent enough
+  void addChanges(Snapshot& s)
+  {
+    const std::size_t tilesX = (engine->getWidth() + 63) / 64, tilesY = (engine->getHeight() + 63) / 64;
+    Bitmap& latest = changes[s.serial % changesKept];
+    latest = Bitmap(0, 0, tilesX, tilesY);
+    engine->takeChanges(latest);
+
+    const std::uint64_t since = drawnSerial;
+    s.changed = latest;
+    s.changedSince = since;
+    // Tiles are only kept for the grid, and engines without edges draw outside it
+    if (!since || s.serial - since > changesKept || !engine->hasEdges()) s.changedSince = 0;
+    for (std::uint64_t n = since + 1; s.changedSince && n < s.serial; n++)
+    {
+      const Bitmap& before = changes[n % changesKept];
+      // A grid of another size since then
+      if (before.w != latest.w || before.h != latest.h) s.changedSince = 0;
+      else for (std::size_t k = 0; k < latest.words.size(); k++) s.changed.words[k] |= before.words[k];
+    }
+  }
+
+  // The cells aren't needed while a fast-forward isn't showing them
+  void fill(Snapshot& s, const std::int64_t region[4], int level) const
+  {
+    const Cells* const cells = dynamic_cast<const Cells*>(engine.get());
+    const HashLife* const hashLife = dynamic_cast<const HashLife*>(engine.get());
+
+    s.cells = Bitmap();
+    s.density = Density();
+    if (!fastForwarding.active && engine->exist() && region[2] > region[0] && region[3] > region[1])
+    {
+      if (level)
+      {
+        // Every block that has some of the region in it
+        const std::int64_t size = std::int64_t{ 1 } << level;
+        const std::int64_t left = region[0] >> level, top = region[1] >> level;
+        const std::int64_t right = (region[2] + size - 1) >> level, bottom = (region[3] + size - 1) >> level;
+        s.density = engine->exportDensity(left, top,
+          static_cast<std::size_t>(right - left), static_cast<std::size_t>(bottom - top), level);
+      }
+      else s.cells = engine->exportBitmap(region[0], region[1],
+        static_cast<std::size_t>(region[2] - region[0]), static_cast<std::size_t>(region[3] - region[1]));
+    }
+
+    s.generation = cells ? cells->generation() : hashLife ? hashLife->getGeneration() : updates;
+    s.counted = cells != nullptr;
+    if (cells)
+    {
+      s.population = cells->population();
+      s.births = cells->births();
+      s.deaths = cells->deaths();
+      s.period = cells->period();
+    }
+
+    s.fastForward = fastForwarding.id;
+    s.fastForwarding = fastForwarding.active;
+    s.fastForwardDone = fastForwarding.done;
+    s.fastForwardTotal = fastForwarding.total;
+    s.fastForwardElapsed = fastForwarding.elapsed;
+    s.fastForwardBudget = fastForwarding.budget;
+  }
+
+public:
+  explicit Simulation(std::unique_ptr<LifeEngine>& e) :engine{ e }
+  {
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+    thread = std::thread(&Simulation::run, this);
+#endif
+  }
+
+  ~Simulation()
+  {
+    {
+      std::lock_guard<std::mutex> lock(stateMutex);
+      quitting = true;
+      stopAsked = true;
+    }
+    wake.notify_one();
+    if (thread.joinable()) thread.join();
+  }
+
+  Simulation(const Simulation&) = delete;
+  Simulation& operator=(const Simulation&) = delete;
+
+  // Runs f, which can do anything to the engine, between generations and shows what it did
+  template <typename F>
+  void change(F f)
+  {
+    {
+      std::lock_guard<std::mutex> lock(engineMutex);
+      f();
+    }
+    refresh();
+  }
+
+  // Asks for a new snapshot even if nothing is running
+  void refresh()
+  {
+    {
+      std::lock_guard<std::mutex> lock(stateMutex);
+      publishWanted = true;
+    }
+    wake.notify_one();
+  }
+
+  // Sets or unsets a cell before the next generation
+  void edit(std::int64_t i, std::int64_t j, bool alive)
+  {
+    {
+      std::lock_guard<std::mutex> lock(stateMutex);
+      edits.push_back({ i, j, alive });
+    }
+    wake.notify_one();
+  }
+
+  void setRunning(bool on)
+  {
+    {
+      std::lock_guard<std::mutex> lock(stateMutex);
+      if (on == running) return;
+      running = on;
+      // Time paused doesn't count towards the next update
+      lastUpdate = Clock::now();
+    }
+    wake.notify_one();
+  }
+
+  // Seconds between updates
+  void setInterval(float seconds)
+  {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    interval = seconds;
+  }
+
+  // The cells the frame shows, and the level of density to show them as when it's zoomed out
+  // too far to draw them one by one, or 0. Snapshots hold a margin around them, so a new
+  // one is only needed when the view gets past that or changes level while nothing is running.
+  void setView(std::int64_t left, std::int64_t top, std::int64_t right, std::int64_t bottom, int level = 0)
+  {
+    {
+      std::lock_guard<std::mutex> lock(stateMutex);
+      view[0] = left;
+      view[1] = top;
+      view[2] = right;
+      view[3] = bottom;
+      viewLevel = level;
+      if (level == shownLevel && left >= shown[0] && top >= shown[1] && right <= shown[2] && bottom <= shown[3]) return;
+      publishWanted = true;
+    }
+    wake.notify_one();
+  }
+
+  // Runs the engine flat out for gens updates or seconds, whichever is first, 0 for no limit.
+  // Snapshots of it have no cells. Returns the id they have in fastForward.
+  std::uint64_t fastForward(std::uint64_t gens, float seconds)
+  {
+    std::uint64_t id;
+    {
+      std::lock_guard<std::mutex> lock(stateMutex);
+      asked = { asked.id + 1, true, 0, gens, seconds, 0.0f };
+      id = asked.id;
+    }
+    wake.notify_one();
+    return id;
+  }
+
+  // Stops a fast-forward where it's got to
+  void stopFastForward()
+  {
+    stopAsked = true;
+    wake.notify_one();
+  }
+
+  // Without a thread of its own, runs whatever is due. Does nothing otherwise.
+  void poll()
+  {
+    if (thread.joinable()) return;
+
+    std::unique_lock<std::mutex> lock(stateMutex);
+    if (ready()) round(lock);
+  }
+
+  // Tells the simulation the frame has the cells of this snapshot on screen,
+  // so the snapshots after it can say which tiles have changed since
+  void drawn(std::uint64_t serial)
+  {
+    drawnSerial = serial;
+  }
+
+  // Picks up the newest snapshot, false if there isn't a new one
+  bool update()
+  {
+    return snapshots.update();
+  }
+
+  const Snapshot& snapshot() const
+  {
+    return snapshots.front();
+  }
+};
+
+#endif
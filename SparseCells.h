@@ -0,0 +1,292 @@
+#ifndef SPARSECELLS_H
+#define SPARSECELLS_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "BitCells.h"
+#include "LifeEngine.h"
+
+// Unbounded universe that only stores the 64x64 tiles that have something alive in them.
+// Tiles live in a hash map keyed by their coordinates, they are created
+// when activity reaches their edge and thrown away once they are empty,
+// so memory follows the population instead of the size of the universe.
+// Each tile is 64 rows of 64 bit words stepped with the same adders as BitCells.
+struct SparseCells : public LifeEngine
+{
+  SparseCells() :exists{ false }, w{ 0 }, h{ 0 } {}
+
+  void setCell(std::int64_t x, std::int64_t y) override
+  {
+    tiles[{ x >> 6, y >> 6 }].rows[y & 63] |= bit(x);
+  }
+
+  void unsetCell(std::int64_t x, std::int64_t y) override
+  {
+    const auto found = tiles.find({ x >> 6, y >> 6 });
+    if (found != tiles.end()) found->second.rows[y & 63] &= ~bit(x);
+  }
+
+  bool isAlive(std::int64_t x, std::int64_t y) const override
+  {
+    const auto found = tiles.find({ x >> 6, y >> 6 });
+    return found != tiles.end() && (found->second.rows[y & 63] & bit(x));
+  }
+
+  void nextGen() override
+  {
+    // Make room for anything that will be born just past the edge of a tile
+    current.clear();
+    for (const auto& t : tiles) current.push_back(t.first);
+    for (const auto k : current)
+    {
+      const auto& rows = tiles[k].rows;
+      std::uint64_t columns{ 0 };
+      for (const auto row : rows) columns |= row;
+
+      const bool top = rows[0] != 0, bottom = rows[63] != 0;
+      const bool left = columns & 1, right = columns >> 63;
+      const std::int64_t tx = k.x, ty = k.y;
+
+      if (top) tiles[{ tx, ty - 1 }];
+      if (bottom) tiles[{ tx, ty + 1 }];
+      if (left) tiles[{ tx - 1, ty }];
+      if (right) tiles[{ tx + 1, ty }];
+      if (top && (rows[0] & 1)) tiles[{ tx - 1, ty - 1 }];
+      if (top && (rows[0] >> 63)) tiles[{ tx + 1, ty - 1 }];
+      if (bottom && (rows[63] & 1)) tiles[{ tx - 1, ty + 1 }];
+      if (bottom && (rows[63] >> 63)) tiles[{ tx + 1, ty + 1 }];
+    }
+
+    for (auto& t : tiles) step(t.first, t.second);
+
+    for (auto it = tiles.begin(); it != tiles.end();)
+    {
+      auto& tile = it->second;
+      std::uint64_t any{ 0 };
+      for (std::size_t y = 0; y < 64; y++)
+      {
+        tile.rows[y] = tile.next[y];
+        any |= tile.rows[y];
+      }
+
+      if (any) ++it;
+      else it = tiles.erase(it);
+    }
+  }
+
+  // The universe has no edges, the dimensions are only used to draw it
+  void setDimensions(std::size_t i, std::size_t j) override
+  {
+    exists = true;
+    w = i;
+    h = j;
+    clear();
+  }
+
+  void setDimensions(std::size_t i)
+  {
+    setDimensions(i, i);
+  }
+
+  std::size_t getWidth() const override
+  {
+    return w;
+  }
+
+  std::size_t getHeight() const override
+  {
+    return h;
+  }
+
+  void destroy() override
+  {
+    exists = false;
+    clear();
+  }
+
+  void clear() override
+  {
+    tiles.clear();
+  }
+
+  bool exist() const override
+  {
+    return exists;
+  }
+
+  bool hasEdges() const override
+  {
+    return false;
+  }
+
+  void forEachLive(const std::function<void(std::int64_t, std::int64_t)>& f) const override
+  {
+    for (const auto& t : tiles)
+    {
+      const std::int64_t x0 = t.first.x * 64, y0 = t.first.y * 64;
+      for (std::int64_t y = 0; y < 64; y++)
+        forEachBit(t.second.rows[y], [&](int b) { f(x0 + b, y0 + y); });
+    }
+  }
+
+  // A tile's rows and the columns of all of them together give its part of the box
+  Box boundingBox() const override
+  {
+    Box box{ INT64_MAX, INT64_MAX, INT64_MIN, INT64_MIN };
+    for (const auto& t : tiles)
+    {
+      std::uint64_t columns{ 0 };
+      int first{ 64 }, last{ -1 };
+      for (int y = 0; y < 64; y++)
+      {
+        if (!t.second.rows[y]) continue;
+        columns |= t.second.rows[y];
+        if (first == 64) first = y;
+        last = y;
+      }
+      if (!columns) continue;
+
+      int lowest{ 0 }, highest{ 63 };
+      while (!(columns >> lowest & 1)) lowest++;
+      while (!(columns >> highest & 1)) highest--;
+
+      const std::int64_t x0 = t.first.x * 64, y0 = t.first.y * 64;
+      box.left = std::min(box.left, x0 + lowest);
+      box.right = std::max(box.right, x0 + highest + 1);
+      box.top = std::min(box.top, y0 + first);
+      box.bottom = std::max(box.bottom, y0 + last + 1);
+    }
+    if (box.empty()) box = { 0, 0, 0, 0 };
+    return box;
+  }
+
+  std::uint64_t population() const override
+  {
+    std::uint64_t n{ 0 };
+    for (const auto& t : tiles)
+      for (const auto row : t.second.rows) n += popcount(row);
+    return n;
+  }
+
+  // Tile rows are the same words as the bitmap's rows, only shifted
+  Bitmap exportBitmap(std::int64_t left, std::int64_t top, std::size_t width, std::size_t height) const override
+  {
+    Bitmap bitmap(left, top, width, height);
+    for (const auto& t : tiles)
+    {
+      const std::int64_t x0 = t.first.x * 64, y0 = t.first.y * 64;
+      for (std::int64_t y = 0; y < 64; y++) bitmap.write(x0, y0 + y, t.second.rows[y]);
+    }
+    return bitmap;
+  }
+
+  void importBitmap(const Bitmap& bitmap) override
+  {
+    clear();
+
+    const std::int64_t first = bitmap.x >> 6, last = (bitmap.x + static_cast<std::int64_t>(bitmap.w) + 63) >> 6;
+    for (std::size_t j = 0; j < bitmap.h; j++)
+    {
+      const std::int64_t y = bitmap.y + static_cast<std::int64_t>(j);
+      for (std::int64_t tx = first; tx < last; tx++)
+      {
+        const std::uint64_t bits = bitmap.read(tx * 64, y);
+        if (bits) tiles[{ tx, y >> 6 }].rows[y & 63] = bits;
+      }
+    }
+  }
+
+  std::size_t tileCount() const
+  {
+    return tiles.size();
+  }
+
+private:
+  struct Tile
+  {
+    std::uint64_t rows[64]{};
+    std::uint64_t next[64]{};
+  };
+
+  // A tile's coordinates are its cells' shifted down by 6, so they never overflow
+  struct TileKey
+  {
+    std::int64_t x;
+    std::int64_t y;
+
+    bool operator==(const TileKey& o) const
+    {
+      return x == o.x && y == o.y;
+    }
+  };
+
+  struct TileKeyHash
+  {
+    std::size_t operator()(const TileKey& k) const
+    {
+      auto h = static_cast<std::uint64_t>(k.x) * 0x9E3779B97F4A7C15 ^ static_cast<std::uint64_t>(k.y);
+      h *= 0xBF58476D1CE4E5B9;
+      return static_cast<std::size_t>(h ^ h >> 31);
+    }
+  };
+
+  static std::uint64_t bit(std::int64_t x)
+  {
+    return std::uint64_t{ 1 } << (x & 63);
+  }
+
+  const Tile* find(std::int64_t tx, std::int64_t ty) const
+  {
+    const auto found = tiles.find({ tx, ty });
+    return found != tiles.end() ? &found->second : nullptr;
+  }
+
+  // Finds the next generation of a tile into its next rows
+  void step(const TileKey& k, Tile& tile) const
+  {
+    const std::int64_t tx = k.x, ty = k.y;
+    const Tile* const n = find(tx, ty - 1);
+    const Tile* const s = find(tx, ty + 1);
+    const Tile* const west = find(tx - 1, ty);
+    const Tile* const east = find(tx + 1, ty);
+    const Tile* const nw = find(tx - 1, ty - 1);
+    const Tile* const ne = find(tx + 1, ty - 1);
+    const Tile* const sw = find(tx - 1, ty + 1);
+    const Tile* const se = find(tx + 1, ty + 1);
+
+    // Rows -1 to 64 of this tile with the words either side of them,
+    // laid out the way BitCells::step reads them
+    std::uint64_t lines[66][3];
+    lines[0][0] = nw ? nw->rows[63] : 0;
+    lines[0][1] = n ? n->rows[63] : 0;
+    lines[0][2] = ne ? ne->rows[63] : 0;
+    for (std::size_t y = 0; y < 64; y++)
+    {
+      lines[y + 1][0] = west ? west->rows[y] : 0;
+      lines[y + 1][1] = tile.rows[y];
+      lines[y + 1][2] = east ? east->rows[y] : 0;
+    }
+    lines[65][0] = sw ? sw->rows[0] : 0;
+    lines[65][1] = s ? s->rows[0] : 0;
+    lines[65][2] = se ? se->rows[0] : 0;
+
+    if (rule == Rules::conway)
+      for (std::size_t y = 0; y < 64; y++)
+        tile.next[y] = BitCells::step(&lines[y][1], &lines[y + 1][1], &lines[y + 2][1]);
+    else
+      for (std::size_t y = 0; y < 64; y++)
+        tile.next[y] = BitCells::step(&lines[y][1], &lines[y + 1][1], &lines[y + 2][1], rule);
+  }
+
+  std::unordered_map<TileKey, Tile, TileKeyHash> tiles;
+  std::vector<TileKey> current;
+  bool exists;
+  std::size_t w;
+  std::size_t h;
+};
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker threads that split a batch of jobs between them.
+// The thread that calls run works on the batch too and returns when
+// every job is done, so the workers never outlive the data they touch.
+class ThreadPool
+{
+  std::vector<std::thread> workers;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable finished;
+
+  std::function<void(std::size_t)> task;
+  std::size_t jobs{ 0 };
+  std::atomic<std::size_t> nextJob{ 0 };
+  std::size_t busy{ 0 };
+  std::size_t round{ 0 };
+  bool quitting{ false };
+
+  void work()
+  {
+    std::size_t seen{ 0 };
+    for (;;)
+    {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&] { return quitting || round != seen; });
+        if (quitting) return;
+        seen = round;
+      }
+
+      doJobs();
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--busy == 0) finished.notify_one();
+    }
+  }
+
+  void doJobs()
+  {
+    for (auto job = nextJob++; job < jobs; job = nextJob++)
+      task(job);
+  }
+
+  void stop()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quitting = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) worker.join();
+    workers.clear();
+    quitting = false;
+  }
+
+public:
+  ThreadPool(std::size_t threads = 1)
+  {
+    resize(threads);
+  }
+
+  ~ThreadPool()
+  {
+    stop();
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // How many threads the hardware can run at once, 1 where there are no threads
+  static std::size_t hardwareThreads()
+  {
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+    return 1;
+#else
+    const auto n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+#endif
+  }
+
+  // Number of threads including the one calling run. 0 means one per hardware thread.
+  void resize(std::size_t threads)
+  {
+    if (threads == 0) threads = hardwareThreads();
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+    threads = 1;
+#endif
+    if (threads == size()) return;
+
+    stop();
+    for (std::size_t i = 1; i < threads; i++)
+      workers.emplace_back(&ThreadPool::work, this);
+  }
+
+  std::size_t size() const
+  {
+    return workers.size() + 1;
+  }
+
+  // Calls f(0) to f(count - 1) spread over the threads and waits for all of them
+  void run(std::size_t count, std::function<void(std::size_t)> f)
+  {
+    if (workers.empty() || count < 2)
+    {
+      for (std::size_t i = 0; i < count; i++) f(i);
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      task = std::move(f);
+      jobs = count;
+      nextJob = 0;
+      busy = workers.size();
+      ++round;
+    }
+    wake.notify_all();
+
+    doJobs();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&] { return busy == 0; });
+  }
+};
+
+#endif
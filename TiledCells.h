@@ -0,0 +1,381 @@
+#ifndef TILEDCELLS_H
+#define TILEDCELLS_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "CellKernels.h"
+#include "LifeEngine.h"
+#include "Pages.h"
+#include "ThreadPool.h"
+
+// The same cells as Cells, one byte each with the neighbour count in it, stepped by
+// the same kernels, but laid out as 64x64 tiles that are each one block of memory.
+// Around every tile is a one cell halo that holds copies of the neighbouring tiles'
+// edges, filled in just before the tile is stepped. The rows a cell reads are then
+// 66 bytes apart instead of a whole grid row, so a tile and the one it's written to
+// fit in L1 however wide the grid is, and each tile can go to any thread by itself.
+// Tiles are stored a row of tiles after the other.
+//
+// The edges are dead, there's no torus.
+struct TiledCells : public LifeEngine
+{
+  TiledCells() :exists{ false }, w{ 0 }, h{ 0 }, cur{ nullptr }, next{ nullptr }, kernel{ CellKernels::best() } {}
+  TiledCells(std::size_t i, std::size_t j) :TiledCells()
+  {
+    setDimensions(i, j);
+  }
+
+  ~TiledCells()
+  {
+    destroy();
+  }
+
+  void setCell(std::int64_t i, std::int64_t j) override
+  {
+    unsigned char* const cell = at(cur, i, j);
+    if (*cell & 0x01) return;
+
+    *cell |= 0x01;
+    inform(i, j, 0x02);
+    changed[tileOf(i, j)] = edited;
+  }
+
+  void unsetCell(std::int64_t i, std::int64_t j) override
+  {
+    unsigned char* const cell = at(cur, i, j);
+    if (!(*cell & 0x01)) return;
+
+    *cell &= ~0x01;
+    inform(i, j, -0x02);
+    changed[tileOf(i, j)] = edited;
+  }
+
+  bool isAlive(std::int64_t i, std::int64_t j) const override
+  {
+    return *at(cur, i, j) & 0x01;
+  }
+
+  // Like Cells, only tiles that changed since two generations ago
+  // or are next to one that did are stepped
+  void nextGen() override
+  {
+    if (!exists) return;
+    if (!pool) pool = std::make_unique<ThreadPool>(threads);
+
+    activeTiles.clear();
+    for (std::size_t ty = 0; ty < tilesY; ty++)
+      for (std::size_t tx = 0; tx < tilesX; tx++)
+      {
+        bool active{ false };
+        for (std::size_t y = ty ? ty - 1 : 0; y <= ty + 1 && y < tilesY; y++)
+          for (std::size_t x = tx ? tx - 1 : 0; x <= tx + 1 && x < tilesX; x++)
+            active |= changed[y * tilesX + x] != 0;
+
+        if (active) activeTiles.push_back(ty * tilesX + tx);
+      }
+
+    std::fill(changedNext.begin(), changedNext.end(), 0);
+
+    // A few jobs per thread so a slow thread doesn't hold up the rest
+    std::size_t jobs = pool->size() * 4;
+    if (jobs > activeTiles.size()) jobs = activeTiles.size();
+
+    // A tile's halo is only written by its own job and only read when it's stepped,
+    // and the edges it's copied from aren't written until next generation
+    const auto step = CellKernels::span(kernel, rule.transitions(), false);
+    const std::uint32_t transitions = rule.transitions();
+    pool->run(jobs, [&](std::size_t job) {
+      const std::size_t first = activeTiles.size() * job / jobs;
+      const std::size_t last = activeTiles.size() * (job + 1) / jobs;
+      for (std::size_t k = first; k < last; k++)
+      {
+        const std::size_t tile = activeTiles[k];
+        const std::size_t tx = tile % tilesX, ty = tile / tilesX;
+        const std::size_t tw = std::min(tileSize, w - tx * tileSize);
+        const std::size_t th = std::min(tileSize, h - ty * tileSize);
+
+        fillHalo(tx, ty);
+
+        const unsigned char* const from = cur + tile * tileBytes;
+        unsigned char* const to = next + tile * tileBytes;
+        bool tileChanged{ false };
+        CellKernels::Tally tally;
+        for (std::size_t y = 1; y <= th; y++)
+          tileChanged |= step(from + 1 + y * side, to + 1 + y * side, side, tw, transitions, tally);
+        // next holds the edited generation after this one so it can't be trusted yet
+        changedNext[tile] = tileChanged || changed[tile] == edited;
+      }
+    });
+
+    std::swap(cur, next);
+    changed.swap(changedNext);
+  }
+
+  // Use a specific kernel instead of the fastest one the CPU supports
+  void setKernel(CellKernels::Type k)
+  {
+    kernel = k > CellKernels::best() ? CellKernels::best() : k;
+  }
+
+  CellKernels::Type getKernel() const
+  {
+    return kernel;
+  }
+
+  // Number of threads nextGen splits the tiles between, 0 for one per hardware thread
+  void setThreadCount(std::size_t n) override
+  {
+    threads = n;
+    if (pool) pool->resize(n);
+  }
+
+  // next was found with the old rule so nothing can be skipped for two generations
+  void setRule(const Rule& r) override
+  {
+    LifeEngine::setRule(r);
+    markAllEdited();
+  }
+
+  void setDimensions(std::size_t i, std::size_t j) override
+  {
+    destroy();
+    w = i;
+    h = j;
+    tilesX = (i + tileSize - 1) / tileSize;
+    tilesY = (j + tileSize - 1) / tileSize;
+
+    // Cells past the edge of the tiles along the right and bottom stay dead
+    cur = Pages::allocate(bufferBytes());
+    next = Pages::allocate(bufferBytes());
+    if (!cur || !next)
+    {
+      Pages::release(cur, bufferBytes());
+      Pages::release(next, bufferBytes());
+      cur = next = nullptr;
+      throw std::bad_alloc();
+    }
+    exists = true;
+
+    changed.assign(tilesX * tilesY, 1);
+    changedNext.assign(tilesX * tilesY, 0);
+    activeTiles.reserve(tilesX * tilesY);
+
+    clear();
+  }
+
+  std::size_t getWidth() const override
+  {
+    return w;
+  }
+
+  std::size_t getHeight() const override
+  {
+    return h;
+  }
+
+  void destroy() override
+  {
+    if (!exists) return;
+
+    Pages::release(cur, bufferBytes());
+    Pages::release(next, bufferBytes());
+    cur = next = nullptr;
+    exists = false;
+  }
+
+  void clear() override
+  {
+    if (!exists) return;
+
+    Pages::zero(cur, bufferBytes());
+    Pages::zero(next, bufferBytes());
+    std::fill(changed.begin(), changed.end(), 1);
+  }
+
+  bool exist() const override
+  {
+    return exists;
+  }
+
+  void forEachLive(const std::function<void(std::int64_t, std::int64_t)>& f) const override
+  {
+    for (std::size_t j = 0; j < h; j++)
+      for (std::size_t i = 0; i < w; i++)
+        if (*at(cur, i, j) & 0x01) f(i, j);
+  }
+
+  std::uint64_t population() const override
+  {
+    std::uint64_t n{ 0 };
+    for (std::size_t j = 0; j < h; j++)
+      for (std::size_t i = 0; i < w; i++) n += *at(cur, i, j) & 0x01;
+    return n;
+  }
+
+  Bitmap exportBitmap(std::int64_t left, std::int64_t top, std::size_t width, std::size_t height) const override
+  {
+    Bitmap bitmap(left, top, width, height);
+    if (!exists) return bitmap;
+
+    const std::int64_t x0 = std::max<std::int64_t>(left, 0), y0 = std::max<std::int64_t>(top, 0);
+    const std::int64_t x1 = std::min<std::int64_t>(left + width, w), y1 = std::min<std::int64_t>(top + height, h);
+    for (std::int64_t j = y0; j < y1; j++)
+      for (std::int64_t i = x0; i < x1; i++)
+        if (*at(cur, i, j) & 0x01) bitmap.set(i, j);
+    return bitmap;
+  }
+
+  void importBitmap(const Bitmap& bitmap) override
+  {
+    clear();
+    if (!exists) return;
+
+    // A row of a tile is a word of the bitmap
+    for (std::size_t ty = 0; ty < tilesY; ty++)
+      for (std::size_t tx = 0; tx < tilesX; tx++)
+      {
+        unsigned char* const t = cur + (ty * tilesX + tx) * tileBytes;
+        const std::size_t tw = std::min(tileSize, w - tx * tileSize);
+        const std::size_t th = std::min(tileSize, h - ty * tileSize);
+        for (std::size_t y = 0; y < th; y++)
+        {
+          std::uint64_t bits = bitmap.read(tx * tileSize, ty * tileSize + y);
+          if (tw < 64) bits &= (std::uint64_t{ 1 } << tw) - 1;
+          unsigned char* const row = t + (y + 1) * side + 1;
+          forEachBit(bits, [&](int b) { row[b] = 0x01; });
+        }
+      }
+
+    // Then the neighbours are counted once, the halos holding the ones in the next tile
+    for (std::size_t ty = 0; ty < tilesY; ty++)
+      for (std::size_t tx = 0; tx < tilesX; tx++) fillHalo(tx, ty);
+
+    for (std::size_t ty = 0; ty < tilesY; ty++)
+      for (std::size_t tx = 0; tx < tilesX; tx++)
+      {
+        unsigned char* const t = cur + (ty * tilesX + tx) * tileBytes;
+        const std::size_t tw = std::min(tileSize, w - tx * tileSize);
+        const std::size_t th = std::min(tileSize, h - ty * tileSize);
+        for (std::size_t y = 1; y <= th; y++)
+          for (std::size_t x = 1; x <= tw; x++)
+          {
+            unsigned char* const c = t + x + y * side;
+            const unsigned int neighbours = (*(c - side - 1) & 0x01) + (*(c - side) & 0x01) + (*(c - side + 1) & 0x01)
+              + (*(c - 1) & 0x01) + (*(c + 1) & 0x01)
+              + (*(c + side - 1) & 0x01) + (*(c + side) & 0x01) + (*(c + side + 1) & 0x01);
+            *c = static_cast<unsigned char>(*c | neighbours << 1);
+          }
+      }
+
+    // next isn't the generation before this one
+    markAllEdited();
+  }
+
+private:
+  // The cell at i, j in a buffer
+  unsigned char* at(unsigned char* const buffer, std::int64_t i, std::int64_t j) const
+  {
+    return buffer + tileOf(i, j) * tileBytes + (static_cast<std::size_t>(j) % tileSize + 1) * side
+      + static_cast<std::size_t>(i) % tileSize + 1;
+  }
+
+  const unsigned char* at(const unsigned char* const buffer, std::int64_t i, std::int64_t j) const
+  {
+    return at(const_cast<unsigned char*>(buffer), i, j);
+  }
+
+  std::size_t tileOf(std::int64_t i, std::int64_t j) const
+  {
+    return static_cast<std::size_t>(j) / tileSize * tilesX + static_cast<std::size_t>(i) / tileSize;
+  }
+
+  // Adds delta to the count of every neighbour of i, j in the grid
+  void inform(std::int64_t i, std::int64_t j, int delta)
+  {
+    for (std::int64_t y = j - 1; y <= j + 1; y++)
+      for (std::int64_t x = i - 1; x <= i + 1; x++)
+      {
+        if ((x == i && y == j) || x < 0 || y < 0 || x >= static_cast<std::int64_t>(w) || y >= static_cast<std::int64_t>(h))
+          continue;
+        unsigned char* const cell = at(cur, x, y);
+        *cell = static_cast<unsigned char>(*cell + delta);
+      }
+  }
+
+  // Copies the edges of the tiles around tx, ty into its halo, dead where there's no tile
+  void fillHalo(std::size_t tx, std::size_t ty)
+  {
+    unsigned char* const t = cur + (ty * tilesX + tx) * tileBytes;
+    const auto tile = [&](std::size_t x, std::size_t y) -> const unsigned char* {
+      return x < tilesX && y < tilesY ? cur + (y * tilesX + x) * tileBytes : nullptr;
+    };
+
+    // Going off the left or top wraps round to a huge index, which tile treats as missing
+    const unsigned char* const n = tile(tx, ty - 1);
+    const unsigned char* const s = tile(tx, ty + 1);
+    const unsigned char* const west = tile(tx - 1, ty);
+    const unsigned char* const east = tile(tx + 1, ty);
+    const unsigned char* const nw = tile(tx - 1, ty - 1);
+    const unsigned char* const ne = tile(tx + 1, ty - 1);
+    const unsigned char* const sw = tile(tx - 1, ty + 1);
+    const unsigned char* const se = tile(tx + 1, ty + 1);
+
+    const std::size_t top = 0, bottom = (tileSize + 1) * side;
+    if (n) std::memcpy(t + top + 1, n + tileSize * side + 1, tileSize);
+    else std::memset(t + top + 1, 0, tileSize);
+    if (s) std::memcpy(t + bottom + 1, s + side + 1, tileSize);
+    else std::memset(t + bottom + 1, 0, tileSize);
+
+    for (std::size_t y = 1; y <= tileSize; y++)
+    {
+      t[y * side] = west ? west[y * side + tileSize] : 0;
+      t[y * side + tileSize + 1] = east ? east[y * side + 1] : 0;
+    }
+
+    t[top] = nw ? nw[tileSize * side + tileSize] : 0;
+    t[top + tileSize + 1] = ne ? ne[tileSize * side + 1] : 0;
+    t[bottom] = sw ? sw[side + tileSize] : 0;
+    t[bottom + tileSize + 1] = se ? se[side + 1] : 0;
+  }
+
+  void markAllEdited()
+  {
+    std::fill(changed.begin(), changed.end(), edited);
+  }
+
+  std::size_t bufferBytes() const
+  {
+    return tilesX * tilesY * tileBytes;
+  }
+
+  static constexpr std::size_t tileSize{ 64 };
+  static constexpr std::size_t side{ tileSize + 2 }; // a row of a tile with its halo
+  // A whole tile with its halo, rounded up to whole cache lines
+  static constexpr std::size_t tileBytes{ (side * side + 63) / 64 * 64 };
+
+  bool exists;
+  std::size_t w;
+  std::size_t h;
+  std::size_t tilesX{ 0 };
+  std::size_t tilesY{ 0 };
+  unsigned char* cur;
+  unsigned char* next;
+  CellKernels::Type kernel;
+  std::size_t threads{ 0 };
+  std::unique_ptr<ThreadPool> pool;
+
+  // 1 for the tiles that are different from two generations ago,
+  // edited for the ones setCell or unsetCell was called on since last generation
+  static constexpr unsigned char edited{ 2 };
+  std::vector<unsigned char> changed;
+  std::vector<unsigned char> changedNext;
+  std::vector<std::size_t> activeTiles;
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+// Hands the newest of a stream of values from one thread to another without either waiting.
+// The writer fills back and publishes it, the reader picks up the newest one published with
+// update and reads front for as long as it likes. The third buffer is the one between them,
+// swapped with an atomic exchange, so neither side ever touches the one the other is using.
+template <typename T>
+class TripleBuffer
+{
+  T buffers[3];
+
+  // The buffer between the two sides, with fresh set if the writer left it there since the reader last looked
+  static constexpr unsigned int fresh{ 4 };
+  std::atomic<unsigned int> middle{ 1 };
+  unsigned int writing{ 0 };
+  unsigned int reading{ 2 };
+
+public:
+  // Writer side
+  T& back()
+  {
+    return buffers[writing];
+  }
+
+  // Writer side, the buffer back gives after this holds whatever was in it before
+  void publish()
+  {
+    writing = middle.exchange(writing | fresh, std::memory_order_acq_rel) & ~fresh;
+  }
+
+  // Reader side, false if nothing was published since last time
+  bool update()
+  {
+    if (!(middle.load(std::memory_order_acquire) & fresh)) return false;
+    reading = middle.exchange(reading, std::memory_order_acq_rel) & ~fresh;
+    return true;
+  }
+
+  // Reader side
+  const T& front() const
+  {
+    return buffers[reading];
+  }
+};
+
+#endif